@@ -0,0 +1,167 @@
+/*
+ * Memory for the audio threads: one contiguous allocation for all of the
+ * per-channel buffers, and keeping it resident
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <alloca.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <wine/windows/windef.h>
+#include <wine/windows/winbase.h>
+
+#include "arena.h"
+
+/* Slices whose stride is a whole number of pages would all land in the
+ * same cache sets, so those get one more line to stagger them.
+ */
+#define ARENA_PAGE      4096
+#define HUGE_PAGE       (2 * 1024 * 1024)
+
+size_t arena_slice(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size % ARENA_PAGE == 0)
+        size += ARENA_ALIGN;
+    return size;
+}
+
+int arena_create(Arena *arena, size_t size)
+{
+    size_t large = GetLargePageMinimum();
+
+    arena->used = 0;
+    arena->huge = 0;
+
+    /* explicit huge pages need SeLockMemoryPrivilege, so this will often fail */
+    if (large)
+    {
+        arena->size = (size + large - 1) & ~(large - 1);
+        arena->base = VirtualAlloc(NULL, arena->size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (arena->base)
+        {
+            arena->huge = 1;
+            return 1;
+        }
+    }
+
+    arena->size = size;
+    arena->base = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!arena->base)
+        return 0;
+
+#ifdef MADV_HUGEPAGE
+    /* otherwise ask for transparent huge pages on whatever whole ones fit */
+    if (size >= HUGE_PAGE)
+    {
+        char *start = (char *)(((size_t)arena->base + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1));
+        char *end = (char *)(((size_t)arena->base + size) & ~(size_t)(HUGE_PAGE - 1));
+
+        if (end > start && madvise(start, end - start, MADV_HUGEPAGE) == 0)
+            arena->huge = 1;
+    }
+#endif
+    return 1;
+}
+
+void *arena_take(Arena *arena, size_t size)
+{
+    char *slice;
+
+    size = arena_slice(size);
+    if (!arena->base || arena->used + size > arena->size)
+        return NULL;
+
+    slice = arena->base + arena->used;
+    arena->used += size;
+    return slice;
+}
+
+void arena_destroy(Arena *arena)
+{
+    if (arena->base)
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->huge = 0;
+}
+
+int mem_lock(void *addr, size_t size)
+{
+    volatile char *p = addr;
+    size_t i;
+
+    if (!addr || !size)
+        return 1;
+
+    if (mlock(addr, size) == 0)
+        return 1;
+
+    /* mlock has not faulted the pages in, so write to each one ourselves; adding
+     * zero atomically cannot lose a store another thread makes meanwhile */
+    for (i = 0; i < size; i += ARENA_PAGE)
+        __sync_fetch_and_add(&p[i], 0);
+    __sync_fetch_and_add(&p[size - 1], 0);
+    return 0;
+}
+
+void mem_unlock(void *addr, size_t size)
+{
+    if (addr && size)
+        munlock(addr, size);
+}
+
+/* not inlined, so the alloca comes off the stack below our caller's frame */
+__attribute__((noinline)) int mem_prefault_stack(size_t size)
+{
+    char *stack = alloca(size);
+
+    return mem_lock(stack, size);
+}
+
+void mem_faults_reset(Faults *faults)
+{
+    faults->minor = 0;
+    faults->major = 0;
+    faults->last_minor = -1;
+    faults->last_major = -1;
+}
+
+void mem_faults_count(Faults *faults)
+{
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_THREAD, &usage) != 0)
+        return;
+
+    if (faults->last_minor >= 0)
+    {
+        faults->minor += usage.ru_minflt - faults->last_minor;
+        faults->major += usage.ru_majflt - faults->last_major;
+    }
+    faults->last_minor = usage.ru_minflt;
+    faults->last_major = usage.ru_majflt;
+#else
+    /* no per-thread counts here, leave them at zero */
+    (void)faults;
+#endif
+}
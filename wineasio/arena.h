@@ -0,0 +1,66 @@
+/*
+ * Memory for the audio threads: one contiguous allocation for all of the
+ * per-channel buffers, and keeping it resident
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_ARENA_H
+#define __WINEASIO_ARENA_H
+
+#include <stddef.h>
+
+/* a cache line; every slice starts on one */
+#define ARENA_ALIGN 64
+
+typedef struct _Arena {
+    char    *base;
+    size_t  size;
+    size_t  used;
+    int     huge;   /* backed by huge pages */
+} Arena;
+
+/* the room arena_take() will use up for size bytes, for sizing the arena */
+extern size_t arena_slice(size_t size);
+
+/* returns 0 if there is no memory; the arena starts out zeroed */
+extern int arena_create(Arena *arena, size_t size);
+
+/* carve off the next slice; NULL once the arena is used up */
+extern void *arena_take(Arena *arena, size_t size);
+
+extern void arena_destroy(Arena *arena);
+
+/* RT memory: mlock a range so none of it faults later, or failing that fault each page in now */
+extern int mem_lock(void *addr, size_t size);
+
+/* and let the range be paged again, before it goes back to the heap */
+extern void mem_unlock(void *addr, size_t size);
+
+/* the same for the next size bytes of the calling thread's stack */
+extern int mem_prefault_stack(size_t size);
+
+/* page faults seen by one thread, counted by that thread */
+typedef struct _Faults {
+    long    minor;
+    long    major;
+    long    last_minor;     /* getrusage at the previous count, -1 before the first */
+    long    last_major;
+} Faults;
+
+extern void mem_faults_reset(Faults *faults);
+extern void mem_faults_count(Faults *faults);
+
+#endif /* __WINEASIO_ARENA_H */
@@ -33,11 +33,30 @@ static const char* ENVVAR_OUTMAP = "OUTPORT";
 static const char* DEFAULT_PREFIX = "ASIO";
 static const char* DEFAULT_INPORT = "Input";
 static const char* DEFAULT_OUTPORT = "Output";
+static const int   MAX_PIPELINE = 4;
+static const int   AUTO_MISSES = 2;
+static const int   AUTO_CLEAN = 30;
+static const int   REBLOCK_MAX = 8;
+static const int   REBLOCK_MIN = 16;
+static const int   EXCLUSIVE_MAX = 8192;
 #endif
 #include "port.h"
+#include "convert.h"
+#include "arena.h"
+#include "handoff.h"
+#include "stats.h"
+#include "recorder.h"
+#include "timeline.h"
+#include "snapshot.h"
+#include "control.h"
+#include "panel.h"
+#include "probes.h"
+#include "timing.h"
 
 //#include <stdarg.h>
 #include <stdio.h>
+#include <math.h>
+#include <errno.h>
 #include <dlfcn.h>
 #include <sys/time.h>
 #include <stdlib.h>
@@ -73,17 +92,20 @@ WINE_DEFAULT_DEBUG_CHANNEL(asio);
 
 /* JACK callback function */
 static int jack_process(jack_nframes_t nframes, void * arg);
+static void jack_thread_init(void * arg);
+static int jack_buffer_size(jack_nframes_t nframes, void * arg);
+static int jack_sample_rate(jack_nframes_t nframes, void * arg);
+static int jack_xrun(void * arg);
+static void jack_latency(jack_latency_callback_mode_t mode, void * arg);
 
 /* WIN32 callback function */
 static DWORD CALLBACK win32_callback(LPVOID arg);
+static DWORD CALLBACK win32_notify(LPVOID arg);
 
 /* {48D0C522-BFCC-45cc-8B84-17F25F33E6E8} */
 static GUID const CLSID_WineASIO = {
 0x48d0c522, 0xbfcc, 0x45cc, { 0x8b, 0x84, 0x17, 0xf2, 0x5f, 0x33, 0xe6, 0xe8 } };
 
-#define twoRaisedTo32           4294967296.0
-#define twoRaisedTo32Reciprocal (1.0 / twoRaisedTo32)
-
 /* ASIO drivers use the thiscall calling convention which only Microsoft compilers
  * produce.  These macros add an extra layer to fixup the registers properly for
  * this calling convention.
@@ -157,12 +179,30 @@ enum
 
 typedef struct _Channel {
    ASIOBool active;
-   int *buffer;
+   char *buffer;
    jack_ringbuffer_t *ring;
    const char  *port_name;
    jack_port_t *port;
 } Channel;
 
+/* What the control socket changes while the driver runs.  The JACK
+ * thread reads it through a Snapshot, the same version for a whole cycle.
+ */
+typedef struct _Live {
+    int                 pipeline;       /* the depth to move to, a period a cycle */
+    int                 pipeline_auto;  /* or tune_pipeline's */
+    float               gain[1];        /* linear; num_inputs, then num_outputs of them */
+} Live;
+
+/* the rings, tempbuf and gain_buf, sized for one period */
+typedef struct _RingSet {
+    Arena               arena;
+    jack_ringbuffer_t   **ring;         /* the active inputs', then the active outputs' */
+    float               *tempbuf;
+    float               *gain_buf;      /* the JACK thread's, a period */
+    long                frames;         /* the period */
+} RingSet;
+
 typedef struct sched_param SCHED_PARAM;
 
 struct IWineASIOImpl
@@ -176,11 +216,10 @@ struct IWineASIOImpl
     ASIOSampleRate      sample_rate;
     long                input_latency;
     long                output_latency;
-    long                block_frames;
+    long                block_frames;   /* the host's buffer size */
+    long                jack_frames;    /* JACK's period, a multiple or divisor of it */
     ASIOTime            asio_time;
     long                miliseconds;
-    ASIOTimeStamp       system_time;
-    double              sample_position;
     ASIOBufferInfo      *bufferInfos;
     ASIOCallbacks       *callbacks;
     char                error_message[256];
@@ -193,8 +232,15 @@ struct IWineASIOImpl
     BOOL                time_info_mode;
     BOOL                tc_read;
     long                state;
+    BOOL                direct;         /* convert in jack_process, no rings */
 //  unsigned int        sample_size;
-//  int                 sample_type;
+    int                 in_format;      /* what getChannelInfo reports */
+    int                 out_format;
+    int                 in_buffer_format;   /* what the current buffers hold */
+    int                 out_buffer_format;
+    BOOL                sample_auto;
+    BOOL                dither;
+    unsigned int        dither_state[DITHER_LANES];
 
     /* JACK stuff */
     char                *client_name;
@@ -214,18 +260,103 @@ struct IWineASIOImpl
     HANDLE              start_event;
     HANDLE              stop_event;
     DWORD               thread_id;
-    sem_t               semaphore1;
-    sem_t               semaphore2;
+    Handoff             wake_win32;     /* JACK thread -> win32 thread */
+    Handoff             wake_jack;      /* and back */
     BOOL                terminate;
 
     Channel             *input;
     Channel             *output;
 
+    Arena               arena;          /* the channels' ASIO buffers */
+    RingSet             rings;          /* what the channels and tempbuf point into */
     float                *tempbuf;
+
+    /* RT memory */
+    BOOL                rt_memory;      /* lock and prefault everything the audio threads touch */
+    int                 stack_prefault; /* KiB of stack to prefault in each audio thread */
+    Faults              jack_faults;    /* seen while running */
+    Faults              win32_faults;
+
+    /* with JACK's process thread created through Wine the callback needs no thread of its own */
+    BOOL                inline_wanted;
+    BOOL                inline_callback;    /* bufferSwitch is called from jack_process */
+
+    /* decoupled mode: the JACK thread never waits for the host */
+    int                 pipeline;           /* periods of output queued ahead, 0 to wait */
+    volatile long       pipeline_frames;    /* input the win32 thread has yet to process */
+    BOOL                pipeline_auto;      /* depth tuned by tune_pipeline */
+    long                tune_cycles;        /* in the current window */
+    int                 tune_misses;        /* in the current window */
+    long                tune_clean;         /* cycles since the last miss */
+    volatile BOOL       latency_changed;    /* for the win32 thread to tell the host */
+
+    /* outputReady */
+    BOOL                in_callback;        /* the host is in bufferSwitch */
+    BOOL                output_posted;      /* and has already let the JACK thread go */
+    BOOL                last_block;         /* the callback is the last the JACK thread waits for */
+
+    /* period and rate changes */
+    BOOL                exclusive;          /* createBuffers sets JACK's period to the host's buffer size */
+    HANDLE              notify_thread;      /* rebuilds and tells the host, whatever the audio threads are doing */
+    sem_t               notify_sem;
+    volatile long       period_changed;     /* the period JACK has moved to, 0 if it hasn't */
+    volatile long       rate_changed;       /* likewise the sample rate */
+    CRITICAL_SECTION    reconfig;           /* the notification thread against createBuffers and disposeBuffers */
+    RingSet             next_rings;         /* made for the new period */
+    RingSet             old_rings;          /* swapped out, freed by the next change */
+    volatile long       swap_frames;        /* next_rings is ready to swap in; -1 while it is */
+
+    /* dropouts */
+    Stats               *stats;             /* in shared memory for outside tools */
+    volatile long       xrun_pending;       /* for the notification thread to tell the host */
+    volatile long       late_pending;
+    volatile long       output_dropped;     /* the win32 thread found no room for a block */
+    volatile long long  posted_ns;          /* when the win32 thread was woken, for its handoff stage */
+    volatile long long  returned_ns;        /* and when it woke the JACK thread again */
+    Recorder            *recorder;          /* the last cycles, for a dump after a dropout */
+    Record              *record;            /* this cycle's */
+    volatile unsigned long long dropout_cycle;
+    unsigned long long  dumped_cycle;       /* the last one dumped for */
+    BOOL                timeline_wanted;
+    int                 timeline_size;      /* MiB */
+    Timeline            *timeline;          /* every stage of every cycle, NULL unless wanted */
+
+    /* the control socket */
+    BOOL                control_wanted;
+    Control             *control;
+    Snapshot            live;               /* what it changes, for the JACK thread */
+    pthread_mutex_t     live_lock;          /* its one writer at a time: the socket or the panel */
+    const Live          *live_now;          /* this cycle's version */
+    float               *gain_buf;          /* an input with its gain applied, from the rings */
+    Panel               *panel;             /* controlPanel's window, once opened */
+
+    /* the graph's latency, from jack_latency */
+    long                capture_latency;    /* what our inputs are connected to */
+    long                playback_latency;   /* and our outputs */
+    volatile long       latency_pending;    /* for the notification thread to pass on */
+
+    /* timestamps */
+    Timing              timing;             /* JACK's latest cycle, for whoever calls the host */
+    long long           stream_frames;      /* queued for the host so far, by the JACK thread */
+    long long           host_frames;        /* and given to it, by the callback thread */
+    jack_nframes_t      cycle_frame;        /* JACK's frame time of the last cycle */
+    long long           frame_clock;        /* and counted from start, through wraparound */
+    Stamp               stamp;              /* the host's current block */
 };
 
 typedef struct IWineASIOImpl              IWineASIOImpl;
 
+static const ASIOSampleType asio_sample_types[SampleFormats] =
+{
+    ASIOSTInt16LSB,
+    ASIOSTInt24LSB,
+    ASIOSTInt32LSB,
+    ASIOSTFloat32LSB,
+    ASIOSTFloat64LSB
+};
+
+static void unlock_memory(IWineASIOImpl *This);
+
 static ULONG WINAPI IWineASIOImpl_AddRef(LPWINEASIO iface)
 {
     IWineASIOImpl *This = (IWineASIOImpl *)iface;
@@ -240,34 +371,47 @@ static ULONG WINAPI IWineASIOImpl_Release(LPWINEASIO iface)
 {
     IWineASIOImpl *This = (IWineASIOImpl *)iface;
     ULONG ref = InterlockedDecrement(&(This->ref));
-    int i;
     TRACE("(%p)\n", iface);
     TRACE("(%p) ref was %d\n", This, ref + 1);
 
     if (!ref) {
         This->state = Exit;
+        control_close(This->control);
+        panel_close(This->panel);
 
         jack_client_close(This->client);
         TRACE("JACK client closed\n");
 
         This->terminate = TRUE;
-        sem_post(&This->semaphore1);
+        handoff_post(&This->wake_win32);
 
         WaitForSingleObject(This->stop_event, INFINITE);
 
-        sem_destroy(&This->semaphore1);
-        sem_destroy(&This->semaphore2);
-
-        for (i = 0; i < This->num_inputs; i++)
-        {
-            jack_ringbuffer_free(This->input[i].ring);
-            This->input[i].ring = NULL;
-        }
-        for (i = 0; i < This->num_outputs; i++)
+        if (This->notify_thread)
         {
-            jack_ringbuffer_free(This->output[i].ring);
-            This->output[i].ring = NULL;
+            sem_post(&This->notify_sem);
+            WaitForSingleObject(This->notify_thread, INFINITE);
+            CloseHandle(This->notify_thread);
         }
+
+        /* only now that nothing is left to count or dump */
+        if (This->rt_memory)
+            unlock_memory(This);
+        stats_close(This->stats);
+        recorder_free(This->recorder);
+        timeline_close(This->timeline);
+        sem_destroy(&This->notify_sem);
+        DeleteCriticalSection(&This->reconfig);
+        pthread_mutex_destroy(&This->live_lock);
+
+        handoff_destroy(&This->wake_win32);
+        handoff_destroy(&This->wake_jack);
+
+        arena_destroy(&This->arena);
+        arena_destroy(&This->rings.arena);
+        arena_destroy(&This->next_rings.arena);
+        arena_destroy(&This->old_rings.arena);
+        snapshot_destroy(&This->live);
         HeapFree(GetProcessHeap(),0,This);
         TRACE("(%p) released\n", This);
     }
@@ -330,6 +474,19 @@ static void read_config(IWineASIOImpl* This)
                 || strstr(line, ENVVAR_INMAP)
                 || strstr(line, ENVVAR_OUTMAP)
                 || strstr(line, ENVVAR_AUTOCONNECT)
+                || strstr(line, ENVVAR_SAMPLETYPE)
+                || strstr(line, ENVVAR_INSAMPLETYPE)
+                || strstr(line, ENVVAR_OUTSAMPLETYPE)
+                || strstr(line, ENVVAR_DITHER)
+                || strstr(line, ENVVAR_RTMEMORY)
+                || strstr(line, ENVVAR_HANDOFF)
+                || strstr(line, ENVVAR_SPIN)
+                || strstr(line, ENVVAR_INLINE)
+                || strstr(line, ENVVAR_PIPELINE)
+                || strstr(line, ENVVAR_EXCLUSIVE)
+                || strstr(line, ENVVAR_TIMELINE)
+                || strstr(line, ENVVAR_CONTROL)
+                || strstr(line, ENVVAR_STACKPREFAULT)
                 || strstr(line, This->client_name) == line
                 ) && strchr(line, '='))
                 {
@@ -387,6 +544,120 @@ static BOOL get_autoconnect(IWineASIOImpl* This)
 
     return (envi == NULL) ? DEFAULT_AUTOCONNECT : (strcasecmp(envi, "true") == 0);
 }
+
+/* one of the converters' names, or "auto" (float32, unless the host turns out to be pre-ASIO 2.0) */
+static int get_sampleformat(IWineASIOImpl* This, const char* inout, int defval)
+{
+    char* envv = NULL, *envi;
+    int format;
+
+    asprintf(&envv, "%s%s", This->client_name, inout);
+    envi = getenv(envv);
+    free(envv);
+    if (envi == NULL) {
+        asprintf(&envv, "%s%s", DEFAULT_PREFIX, inout);
+        envi = getenv(envv);
+        free(envv);
+    }
+    if (envi == NULL)
+        return defval;
+
+    if (strcasecmp(envi, "auto") == 0)
+    {
+        This->sample_auto = TRUE;
+        return SampleFloat32;
+    }
+    if ((format = convert_lookup(envi)) < 0)
+    {
+        WARN("(%p) unknown sample type '%s'\n", This, envi);
+        return defval;
+    }
+    return format;
+}
+
+/* 0 to 4 periods, or "auto" to have tune_pipeline pick */
+static int get_pipeline(IWineASIOImpl* This)
+{
+    char* envv = NULL, *envi;
+
+    asprintf(&envv, "%s%s", This->client_name, ENVVAR_PIPELINE);
+    envi = getenv(envv);
+    free(envv);
+    if (envi == NULL) {
+        asprintf(&envv, "%s%s", DEFAULT_PREFIX, ENVVAR_PIPELINE);
+        envi = getenv(envv);
+        free(envv);
+    }
+    if (envi == NULL)
+        return DEFAULT_PIPELINE;
+
+    if (strcasecmp(envi, "auto") == 0)
+    {
+        This->pipeline_auto = TRUE;
+        return 1;
+    }
+    return atoi(envi);
+}
+
+/* "true" or anything else */
+static BOOL get_boolean(IWineASIOImpl* This, const char* var, BOOL defval)
+{
+    char* envv = NULL, *envi;
+
+    asprintf(&envv, "%s%s", This->client_name, var);
+    envi = getenv(envv);
+    free(envv);
+    if (envi == NULL) {
+        asprintf(&envv, "%s%s", DEFAULT_PREFIX, var);
+        envi = getenv(envv);
+        free(envv);
+    }
+
+    return (envi == NULL) ? defval : (strcasecmp(envi, "true") == 0);
+}
+
+/* a whole number, 0 or more: sizes and times, not channel counts */
+static int get_number(IWineASIOImpl* This, const char* var, int defval)
+{
+    char* envv = NULL, *envi, *end;
+    long value;
+
+    asprintf(&envv, "%s%s", This->client_name, var);
+    envi = getenv(envv);
+    free(envv);
+    if (envi == NULL) {
+        asprintf(&envv, "%s%s", DEFAULT_PREFIX, var);
+        envi = getenv(envv);
+        free(envv);
+    }
+    if (envi == NULL)
+        return defval;
+
+    value = strtol(envi, &end, 10);
+    if (end == envi || *end || value < 0 || value > 0x7fffffff)
+    {
+        WARN("(%p) %s of \"%s\" is not a number, using %d\n", This, var + 1, envi, defval);
+        return defval;
+    }
+    return (int)value;
+}
+
+/* "semaphore" or "futex" */
+static BOOL get_futex(IWineASIOImpl* This)
+{
+    char* envv = NULL, *envi;
+
+    asprintf(&envv, "%s%s", This->client_name, ENVVAR_HANDOFF);
+    envi = getenv(envv);
+    free(envv);
+    if (envi == NULL) {
+        asprintf(&envv, "%s%s", DEFAULT_PREFIX, ENVVAR_HANDOFF);
+        envi = getenv(envv);
+        free(envv);
+    }
+
+    return (envi == NULL) ? DEFAULT_FUTEX : (strcasecmp(envi, "futex") == 0);
+}
 #else
 static int GetEXEName(DWORD dwProcessID, char* name) {
     DWORD aProcesses [1024], cbNeeded, cProcesses;
@@ -493,6 +764,20 @@ static char* get_targetname(IWineASIOImpl* This, const char* inout, int i)
     return envi;
 }
 
+/* what get_targetname finds from now on, for this client */
+static void set_targetname(IWineASIOImpl* This, const char* inout, int i, const char* port)
+{
+    char* envv = NULL;
+
+#ifndef JackWASIO
+    asprintf(&envv, "%s%s%d", This->client_name, inout, i);
+#else
+    asprintf(&envv, "%s%d", inout, i);
+#endif
+    setenv(envv, port, 1);
+    free(envv);
+}
+
 static void set_clientname(IWineASIOImpl *This)
 {
 #ifndef JackWASIO
@@ -549,177 +834,934 @@ static void set_portname(IWineASIOImpl *This, const char* inout, const char* def
     free(envv);
 }
 
-WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *sysHandle))
+/* Keep everything the audio threads touch resident, so the first cycle and
+ * the first after memory pressure do not page fault.  mlock can fail on a
+ * low RLIMIT_MEMLOCK; the pages are still touched.
+ */
+static void lock_memory(IWineASIOImpl *This)
 {
-    IWineASIOImpl *This = (IWineASIOImpl *)iface;
-    jack_status_t status;
-    int i;
-    TRACE("(%p, %p)\n", iface, sysHandle);
+    if (!mem_lock(This, sizeof(*This))
+        || !mem_lock(This->input, This->num_inputs * sizeof(Channel))
+        || !mem_lock(This->output, This->num_outputs * sizeof(Channel))
+        || !mem_lock(This->arena.base, This->arena.size)
+        || !mem_lock(This->stats, sizeof(Stats))
+        || !mem_lock(This->recorder, sizeof(Recorder))
+        || (This->timeline && !mem_lock(This->timeline, sizeof(Timeline)))
+        || !mem_lock(This->live.copy[0], This->live.size)
+        || !mem_lock(This->live.copy[1], This->live.size))
+        WARN("(%p) couldn't lock the buffers, check RLIMIT_MEMLOCK\n", This);
+}
 
-    This->sample_rate = 48000.0;
-    This->block_frames = 1024;
-    This->input_latency = This->block_frames;
-    This->output_latency = This->block_frames;
-    This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
-    This->callbacks = NULL;
-    This->sample_position = 0;
-    strcpy(This->error_message, "No Error");
-    This->num_inputs = 0;
-    This->num_outputs = 0;
-    This->active_inputs = 0;
-    This->active_outputs = 0;
-    This->toggle = 0;
-    This->client_state = Init;
-    This->time_info_mode = FALSE;
-    This->tc_read = FALSE;
-    This->terminate = FALSE;
-    This->state = Init;
-    This->jack_client_priority.sched_priority = -1;
+/* and unlock what outlives the buffers, for Release; the arenas are unmapped whole */
+static void unlock_memory(IWineASIOImpl *This)
+{
+    mem_unlock(This->input, This->num_inputs * sizeof(Channel));
+    mem_unlock(This->output, This->num_outputs * sizeof(Channel));
+    mem_unlock(This->stats, sizeof(Stats));
+    mem_unlock(This->recorder, sizeof(Recorder));
+    mem_unlock(This->timeline, sizeof(Timeline));
+    mem_unlock(This->live.copy[0], This->live.size);
+    mem_unlock(This->live.copy[1], This->live.size);
+    mem_unlock(This, sizeof(*This));
+}
 
-    sem_init(&This->semaphore1, 0, 0);
-    sem_init(&This->semaphore2, 0, 0);
+/* The driver's own buffering in each direction */
+static void own_latencies(IWineASIOImpl *This, long *input, long *output)
+{
+    /* reblocking to a bigger host buffer queues all but a period of one more block */
+    *input = This->block_frames;
+    *output = This->block_frames > This->jack_frames ? This->block_frames : This->jack_frames;
 
-    This->start_event = CreateEventW(NULL, FALSE, FALSE, NULL);
-    This->stop_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    /* decoupled, output is played this many JACK periods after the host wrote it */
+    if (This->pipeline)
+        *output += This->pipeline * This->jack_frames;
+}
 
-    set_clientname(This);
+/* What getLatencies reports: that, and the latency JACK has for whatever the ports are connected to */
+static void update_latencies(IWineASIOImpl *This)
+{
+    long input, output;
 
-#ifndef JackWASIO
-    // uses This->client_name
-    read_config(This);
-#else
-    ReadJPPrefs();
-#endif
+    own_latencies(This, &input, &output);
+    This->input_latency = input + This->capture_latency;
+    This->output_latency = output + This->playback_latency;
+}
 
-    This->client = jack_client_open(This->client_name, JackNullOption, &status, NULL);
-    if (This->client == NULL)
-    {
-        WARN("(%p) failed to open jack server\n", This);
-        return ASIOFalse;
-    }
+/* JACK's microseconds to timeGetTime()'s nanoseconds: catch timeGetTime()
+ * as it ticks over, so the offset is good to well under its resolution.
+ * Both run off the monotonic clock, so it holds while the host runs.
+ */
+static void calibrate_timing(IWineASIOImpl *This)
+{
+    DWORD then = timeGetTime(), now;
+    int tries = 1000000;
+    jack_time_t usecs;
 
-    TRACE("JACK client opened, client name: '%s'; sample rate: %f\n", jack_get_client_name(This->client), This->sample_rate);
+    do
+        now = timeGetTime();
+    while (now == then && --tries);
+    usecs = jack_get_time();
 
-    if (status & JackServerStarted)
-        TRACE("(%p) JACK server started\n", This);
+    This->timing.offset = (long long)now * 1000000 - (long long)usecs * 1000;
+    TRACE("(%p) JACK time %llu us is timeGetTime() %lu ms\n", This, (unsigned long long)usecs, (unsigned long)now);
+}
 
-    /* get maximum reccomended client priority from JACK */
+/* An asioMessage the host may not know; FALSE if it doesn't, or doesn't
+ * act on it, or has no buffers to be told about.  Only from win32 threads.
+ */
+static BOOL tell_host(IWineASIOImpl *This, long selector, long value)
+{
+    ASIOCallbacks *callbacks = This->callbacks;
 
-    This->jack_client_priority.sched_priority = jack_client_real_time_priority (This->client);
-    This->thread = CreateThread(NULL, 0, win32_callback, (LPVOID)This, 0, &This->thread_id);
-    if (This->thread)
-    {
-        WaitForSingleObject(This->start_event, INFINITE);
-        CloseHandle(This->start_event);
-        This->start_event = INVALID_HANDLE_VALUE;
-    }
-    else
-    {
-        WARN("(%p) Couldn't create thread\n", This);
-        return ASIOFalse;
-    }
+    if (!callbacks || !callbacks->asioMessage(kAsioSelectorSupported, selector, 0, 0))
+        return FALSE;
+    return callbacks->asioMessage(selector, value, 0, 0) != 0;
+}
 
-    jack_set_process_callback(This->client, jack_process, This);
+/* The silence the outputs start with, for JACK to play while the host
+ * works on its first blocks: the pipeline when decoupled, and when
+ * reblocking to a bigger host buffer the periods before the first block
+ * is complete.
+ */
+static long ring_prefill(IWineASIOImpl *This, long frames)
+{
+    long prefill = This->pipeline * frames;
 
-    This->sample_rate = jack_get_sample_rate(This->client);
-    This->block_frames = jack_get_buffer_size(This->client);
+    if (This->block_frames > frames)
+        prefill += This->block_frames - frames;
+    return prefill;
+}
 
-    This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
-    This->input_latency = This->block_frames;
-    This->output_latency = This->block_frames;
+/* Empty the rings, but for that silence */
+static void reset_rings(IWineASIOImpl *This)
+{
+    long prefill = ring_prefill(This, This->jack_frames);
+    int i;
 
-    This->active_inputs = 0;
-#ifndef JackWASIO
-    This->num_inputs = get_numChannels(This, ENVVAR_INPUTS, DEFAULT_NUMINPUTS);
-#else
-    This->num_inputs = MAX_INPUTS;
-#endif
-    This->input = HeapAlloc(GetProcessHeap(), 0, sizeof(Channel) * This->num_inputs);
-    if (!This->input)
-    {
-        MESSAGE("(%p) Not enough memory for %d input channels\n", This, This->num_inputs);
-        return ASIOFalse;
-    }
-    TRACE("(%p) Max inputs: %d\n", This, This->num_inputs);
-    for (i = 0; i < This->num_inputs; i++)
+    for (i = 0; i < This->active_inputs; i++)
+        This->input[i].ring->read_ptr = This->input[i].ring->write_ptr = 0;
+
+    for (i = 0; i < This->active_outputs; i++)
     {
-        This->input[i].active = ASIOFalse;
-        This->input[i].buffer = NULL;
-        set_portname(This, ENVVAR_INPORTNAMEPREFIX, DEFAULT_INPORT, i, This->input);
-        TRACE("(%p) input %d: '%s'\n", This, i, This->input[i].port_name);
+        jack_ringbuffer_t *ring = This->output[i].ring;
 
-        This->input[i].port = jack_port_register(This->client,
-            This->input[i].port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-        if (This->input[i].port)
-            TRACE("(%p) Registered input port %i: '%s' (%p)\n", This, i, This->input[i].port_name, This->input[i].port);
-        else {
-            MESSAGE("(%p) Failed to register input port %i ('%s')\n", This, i, This->input[i].port_name);
-            return ASE_NotPresent;
-        }
-        This->input[i].ring = NULL;
-        This->input[i].ring = jack_ringbuffer_create(4 * This->block_frames * sizeof(float));
-        if (!This->input[i].ring)
-        {
-            WARN("no input ringbuffer memory\n");
-            return ASE_NotPresent;
-        }
+        ring->read_ptr = ring->write_ptr = 0;
+        memset(ring->buf, 0, ring->size);
+        jack_ringbuffer_write_advance(ring, prefill * sizeof(float));
     }
+    This->pipeline_frames = 0;
+}
 
-    This->active_outputs = 0;
-#ifndef JackWASIO
-    This->num_outputs = get_numChannels(This, ENVVAR_OUTPUTS, DEFAULT_NUMOUTPUTS);
-#else
-    This->num_outputs = MAX_OUTPUTS;
-#endif
-    This->output =  HeapAlloc(GetProcessHeap(), 0, sizeof(Channel) * This->num_outputs);
-    if (!This->output)
+/* Auto pipeline: a miss is the host still being a whole pipeline behind
+ * when JACK wants its output.  AUTO_MISSES of them inside a second add a
+ * period (by playing this cycle's silence instead of consuming any), and
+ * AUTO_CLEAN seconds without one take a period away again.  Returns the
+ * periods to drop (negative) or hold back (positive) from the outputs.
+ */
+static int tune_pipeline(IWineASIOImpl *This, jack_nframes_t nframes, BOOL late)
+{
+    long second = (long)This->sample_rate / nframes;
+
+    if (late)
     {
-        MESSAGE("(%p) Not enough memory for %d output channels\n", This, This->num_outputs);
-        return ASIOFalse;
+        This->tune_misses++;
+        This->tune_clean = 0;
     }
-    TRACE("(%p) Max outputs: %d\n", This, This->num_outputs);
-    for (i = 0; i < This->num_outputs; i++)
+    else
+        This->tune_clean++;
+
+    if (++This->tune_cycles >= second)
     {
-        This->output[i].active = ASIOFalse;
-        This->output[i].buffer = NULL;
-        set_portname(This, ENVVAR_OUTPORTNAMEPREFIX, DEFAULT_OUTPORT, i, This->output);
-        TRACE("(%p) output %d: '%s'\n", This, i, This->output[i].port_name);
+        int misses = This->tune_misses;
 
-        This->output[i].port = jack_port_register(This->client, 
-            This->output[i].port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-        if (This->output[i].port)
-            TRACE("(%p) Registered output port %i: '%s' (%p)\n", This, i, This->output[i].port_name, This->output[i].port);
-        else {
-            MESSAGE("(%p) Failed to register output port %i ('%s')\n", This, i, This->output[i].port_name);
-            return ASE_NotPresent;
-        }
-        This->output[i].ring = NULL;
-        This->output[i].ring = jack_ringbuffer_create(4 * This->block_frames * sizeof(float));
-        if (!This->output[i].ring)
+        This->tune_cycles = 0;
+        This->tune_misses = 0;
+        if (misses >= AUTO_MISSES && This->pipeline < MAX_PIPELINE)
         {
-            WARN("no output ringbuffer memory\n");
-            return ASE_NotPresent;
+            This->pipeline++;
+            This->latency_changed = TRUE;
+            return 1;
         }
     }
 
-    This->tempbuf = HeapAlloc(GetProcessHeap(), 0, This->block_frames * sizeof(float));
-
-    return ASIOTrue;
+    if (This->tune_clean >= AUTO_CLEAN * second && This->pipeline > 1)
+    {
+        This->tune_clean = 0;
+        This->pipeline--;
+        This->latency_changed = TRUE;
+        return -1;
+    }
+    return 0;
 }
 
-WRAP_THISCALL( void __stdcall, IWineASIOImpl_getDriverName, (LPWINEASIO iface, char *name))
+/* A depth set through the control socket: a period a cycle, the way
+ * tune_pipeline would get there
+ */
+static int follow_pipeline(IWineASIOImpl *This, int depth)
 {
-    TRACE("(%p, %p)\n", iface, name);
-    strcpy(name, "Wine ASIO");
+    if (depth == This->pipeline)
+        return 0;
+    This->latency_changed = TRUE;
+    if (depth > This->pipeline)
+    {
+        This->pipeline++;
+        return 1;
+    }
+    This->pipeline--;
+    return -1;
 }
 
-WRAP_THISCALL( long __stdcall, IWineASIOImpl_getDriverVersion, (LPWINEASIO iface))
+static size_t live_size(IWineASIOImpl *This)
 {
-    TRACE("(%p)\n", iface);
-    return 80; // 0.8 (patch level 0)
+    size_t size = offsetof(Live, gain) + (This->num_inputs + This->num_outputs) * sizeof(float);
+
+    return size > sizeof(Live) ? size : sizeof(Live);
 }
 
-WRAP_THISCALL( void __stdcall, IWineASIOImpl_getErrorMessage, (LPWINEASIO iface, char *string))
+/* unity gains and the configured pipeline; once the channels are known */
+static BOOL init_live(IWineASIOImpl *This)
+{
+    Live *live;
+    int i;
+
+    if (!snapshot_init(&This->live, live_size(This)))
+        return FALSE;
+
+    live = snapshot_edit(&This->live, 0);
+    live->pipeline = This->pipeline;
+    live->pipeline_auto = This->pipeline_auto;
+    for (i = 0; i < This->num_inputs + This->num_outputs; i++)
+        live->gain[i] = 1.0f;
+    snapshot_publish(&This->live);
+    This->live_now = snapshot_current(&This->live);
+    return TRUE;
+}
+
+/* the spare copy of the live settings, to change and publish */
+static Live *edit_live(IWineASIOImpl *This, FILE *reply)
+{
+    Live *live = snapshot_edit(&This->live, 1000);
+
+    if (!live && reply)
+        fprintf(reply, "error: the JACK thread hasn't finished a cycle in a second\n");
+    return live;
+}
+
+/* 1 to MAX_PIPELINE, or 0 for auto; the caller has checked we are decoupled */
+static BOOL set_pipeline(IWineASIOImpl *This, int depth, FILE *reply)
+{
+    Live *live = edit_live(This, reply);
+
+    if (!live)
+        return FALSE;
+    live->pipeline_auto = !depth;
+    if (depth)
+        live->pipeline = depth;
+    snapshot_publish(&This->live);
+    return TRUE;
+}
+
+static const char *control_mode(IWineASIOImpl *This)
+{
+    if (This->pipeline)
+        return "decoupled";
+    if (This->inline_callback)
+        return This->direct ? "direct inline" : "rings inline";
+    return This->direct ? "direct" : "rings";
+}
+
+static void control_stats(IWineASIOImpl *This, FILE *reply)
+{
+    const Live *live = snapshot_current(&This->live);
+
+    fprintf(reply, "client %s\n", This->stats->client);
+    fprintf(reply, "state %s\n", This->state == Run ? "running" : "stopped");
+    fprintf(reply, "sample_rate %.0f\n", This->sample_rate);
+    fprintf(reply, "period %ld\n", This->jack_frames);
+    fprintf(reply, "buffer %ld\n", This->block_frames);
+    fprintf(reply, "mode %s\n", control_mode(This));
+    fprintf(reply, "pipeline %d%s\n", This->pipeline, This->pipeline && live->pipeline_auto ? " auto" : "");
+    fprintf(reply, "format %s %s\n", converters[This->in_buffer_format].name, converters[This->out_buffer_format].name);
+    fprintf(reply, "inputs %ld of %u\n", This->active_inputs, This->num_inputs);
+    fprintf(reply, "outputs %ld of %u\n", This->active_outputs, This->num_outputs);
+    fprintf(reply, "latency %ld %ld\n", This->input_latency, This->output_latency);
+    fprintf(reply, "cycles %llu\n", This->stats->cycles);
+    fprintf(reply, "xruns %u\n", This->stats->xruns);
+    fprintf(reply, "late %u\n", This->stats->late);
+}
+
+/* "in" or "out", and a channel number of that side */
+static int control_channel(IWineASIOImpl *This, const char *side, const char *number, BOOL *input)
+{
+    char *end;
+    long i;
+
+    if (!side || !number)
+        return -1;
+    i = strtol(number, &end, 10);
+    if (*end || i < 0)
+        return -1;
+    if (strcmp(side, "in") == 0 && i < This->num_inputs)
+        *input = TRUE;
+    else if (strcmp(side, "out") == 0 && i < This->num_outputs)
+        *input = FALSE;
+    else
+        return -1;
+    return (int)i;
+}
+
+static void control_gain(IWineASIOImpl *This, char **args, FILE *reply)
+{
+    const char *side = strtok_r(NULL, " \t", args), *number = strtok_r(NULL, " \t", args), *db = strtok_r(NULL, " \t", args);
+    const Live *current = snapshot_current(&This->live);
+    Live *live;
+    BOOL input;
+    double value;
+    char *end;
+    int i;
+
+    if (!side)
+    {
+        for (i = 0; i < This->num_inputs + This->num_outputs; i++)
+            fprintf(reply, "%s %d %.1f dB\n", i < This->num_inputs ? "in" : "out",
+                i < This->num_inputs ? i : i - This->num_inputs, 20.0 * log10(current->gain[i]));
+        fprintf(reply, "ok\n");
+        return;
+    }
+    if ((i = control_channel(This, side, number, &input)) < 0 || !db)
+    {
+        fprintf(reply, "error: gain in|out <channel> <dB>\n");
+        return;
+    }
+    value = strtod(db, &end);
+    /* strtod takes nan and inf too; only -inf, for mute, is a gain */
+    if (*end || (!isfinite(value) && !(value < 0.0)) || value > 24.0)
+    {
+        fprintf(reply, "error: a gain in dB, up to 24 or -inf\n");
+        return;
+    }
+    if (!(live = edit_live(This, reply)))
+        return;
+    live->gain[input ? i : This->num_inputs + i] = (float)pow(10.0, value / 20.0);
+    snapshot_publish(&This->live);
+    fprintf(reply, "ok\n");
+}
+
+/* Where a channel is connected to, from now on and at the next start */
+static void control_connect(IWineASIOImpl *This, char **args, FILE *reply)
+{
+    const char *side = strtok_r(NULL, " \t", args), *number = strtok_r(NULL, " \t", args), *port = strtok_r(NULL, "", args);
+    Channel *channel;
+    BOOL input;
+    int i, err;
+
+    if ((i = control_channel(This, side, number, &input)) < 0 || !port)
+    {
+        fprintf(reply, "error: connect in|out <channel> <JACK port>\n");
+        return;
+    }
+    set_targetname(This, input ? ENVVAR_INMAP : ENVVAR_OUTMAP, i, port);
+
+    /* start only connects the active channels */
+    channel = input ? &This->input[i] : &This->output[i];
+    if (This->state != Run || channel->active != ASIOTrue)
+    {
+        fprintf(reply, "ok\n");
+        return;
+    }
+    jack_port_disconnect(This->client, channel->port);
+    if (input)
+        err = jack_connect(This->client, port, jack_port_name(channel->port));
+    else
+        err = jack_connect(This->client, jack_port_name(channel->port), port);
+    if (err)
+        fprintf(reply, "error: couldn't connect to %s\n", port);
+    else
+        fprintf(reply, "ok\n");
+}
+
+/* Only while decoupled: the rings are sized for any depth then, and the
+ * JACK thread moves to it a period at a time.  Coupled, it takes a new
+ * createBuffers.
+ */
+static void control_pipeline(IWineASIOImpl *This, char **args, FILE *reply)
+{
+    const char *arg = strtok_r(NULL, " \t", args);
+    char *end;
+    long depth = 0;
+
+    if (!arg)
+    {
+        fprintf(reply, "pipeline %d%s\n", This->pipeline,
+            This->pipeline && ((const Live *)snapshot_current(&This->live))->pipeline_auto ? " auto" : "");
+        fprintf(reply, "ok\n");
+        return;
+    }
+    if (!This->pipeline)
+    {
+        fprintf(reply, "error: not decoupled, set PIPELINE before the host starts\n");
+        return;
+    }
+    if (strcmp(arg, "auto") != 0
+        && ((depth = strtol(arg, &end, 10)) < 1 || depth > MAX_PIPELINE || *end))
+    {
+        fprintf(reply, "error: pipeline auto or 1 to %d\n", MAX_PIPELINE);
+        return;
+    }
+    if (set_pipeline(This, depth, reply))
+        fprintf(reply, "ok\n");
+}
+
+/* The control socket's commands, on its own thread.  What the JACK
+ * thread has to see goes through This->live; the rest is read as it is.
+ */
+static void control_command(void *arg, char *line, FILE *reply)
+{
+    IWineASIOImpl *This = (IWineASIOImpl *)arg;
+    char *args;
+    const char *command = strtok_r(line, " \t", &args);
+
+    pthread_mutex_lock(&This->live_lock);
+    if (!command)
+        fprintf(reply, "error: no command\n");
+    else if (strcmp(command, "stats") == 0)
+    {
+        control_stats(This, reply);
+        fprintf(reply, "ok\n");
+    }
+    else if (strcmp(command, "gain") == 0)
+        control_gain(This, &args, reply);
+    else if (strcmp(command, "connect") == 0)
+        control_connect(This, &args, reply);
+    else if (strcmp(command, "pipeline") == 0)
+        control_pipeline(This, &args, reply);
+    else if (strcmp(command, "help") == 0)
+        fprintf(reply, "stats\n"
+            "gain [in|out <channel> <dB>]\n"
+            "connect in|out <channel> <JACK port>\n"
+            "pipeline [auto|<periods>]\n"
+            "ok\n");
+    else
+        fprintf(reply, "error: unknown command '%s', try help\n", command);
+    pthread_mutex_unlock(&This->live_lock);
+}
+
+/* The panel's, on its window's thread, which must never wait on live_lock:
+ * the control thread can hold it for a second in snapshot_edit.
+ */
+static void panel_state(void *arg, PanelState *state)
+{
+    IWineASIOImpl *This = (IWineASIOImpl *)arg;
+
+    /* one int of whichever copy is current, so at worst a refresh behind */
+    state->pipeline_auto = ((const Live *)snapshot_current(&This->live))->pipeline_auto;
+
+    state->mode = control_mode(This);
+    state->in_format = converters[This->in_buffer_format].name;
+    state->out_format = converters[This->out_buffer_format].name;
+    state->sample_rate = This->sample_rate;
+    state->period = This->jack_frames;
+    state->buffer = This->block_frames;
+    state->pipeline = This->pipeline;
+    state->dither = This->dither;
+}
+
+static void panel_set_pipeline(void *arg, int depth)
+{
+    IWineASIOImpl *This = (IWineASIOImpl *)arg;
+
+    if (!This->pipeline)
+        return;
+    /* the next refresh puts the list back if the control socket is busy */
+    if (pthread_mutex_trylock(&This->live_lock) != 0)
+    {
+        TRACE("(%p) pipeline not set from the panel, the control socket has it\n", This);
+        return;
+    }
+    if (set_pipeline(This, depth, NULL))
+        TRACE("(%p) pipeline set to %d from the panel\n", This, depth);
+    pthread_mutex_unlock(&This->live_lock);
+}
+
+/* each conversion reads it once, so it only ever takes effect between blocks */
+static void panel_set_dither(void *arg, int dither)
+{
+    IWineASIOImpl *This = (IWineASIOImpl *)arg;
+
+    This->dither = dither;
+    TRACE("(%p) dither %s from the panel\n", This, dither ? "on" : "off");
+}
+
+static const PanelOps panel_ops = {
+    panel_state,
+    panel_set_pipeline,
+    panel_set_dither
+};
+
+/* JACK's threads, started as win32 threads so the host can be called from them */
+typedef struct _ThreadStart {
+    void                *(*function)(void *);
+    void                *arg;
+    const pthread_attr_t *attr;
+    pthread_t           thread;
+    HANDLE              started;
+} ThreadStart;
+
+static __thread BOOL win32_thread = FALSE;
+
+static DWORD WINAPI jack_thread_start(LPVOID arg)
+{
+    ThreadStart *start = (ThreadStart *)arg;
+    void *(*function)(void *) = start->function;
+    void *function_arg = start->arg;
+    struct sched_param param;
+    int policy;
+
+    win32_thread = TRUE;
+    start->thread = pthread_self();
+
+    /* CreateThread knows nothing of the realtime scheduling JACK asked for */
+    if (start->attr
+        && pthread_attr_getschedpolicy(start->attr, &policy) == 0 && policy != SCHED_OTHER
+        && pthread_attr_getschedparam(start->attr, &param) == 0
+        && pthread_setschedparam(pthread_self(), policy, &param) != 0)
+        TRACE("couldn't set the JACK thread to priority %d\n", param.sched_priority);
+
+    /* start is gone once the creator has been told */
+    SetEvent(start->started);
+    function(function_arg);
+    return 0;
+}
+
+static int jack_thread_creator(pthread_t *thread_id, const pthread_attr_t *attr, void *(*function)(void *), void *arg)
+{
+    ThreadStart start;
+    HANDLE thread;
+
+    start.function = function;
+    start.arg = arg;
+    start.attr = attr;
+    start.started = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    thread = CreateThread(NULL, 0, jack_thread_start, &start, 0, NULL);
+    if (!thread)
+    {
+        WARN("couldn't create a thread for JACK\n");
+        CloseHandle(start.started);
+        return EAGAIN;
+    }
+
+    WaitForSingleObject(start.started, INFINITE);
+    CloseHandle(start.started);
+    CloseHandle(thread);
+
+    *thread_id = start.thread;
+    return 0;
+}
+
+/* a JACK ring buffer with its storage in the arena; jack_ringbuffer_free must never see it */
+static jack_ringbuffer_t *ring_take(Arena *arena, size_t size)
+{
+    jack_ringbuffer_t *ring = arena_take(arena, sizeof(jack_ringbuffer_t));
+
+    ring->buf = arena_take(arena, size);
+    ring->size = size;
+    ring->size_mask = size - 1;
+    ring->write_ptr = 0;
+    ring->read_ptr = 0;
+    ring->mlocked = 0;
+    return ring;
+}
+
+/* a whole number of periods to a host buffer, or of host buffers to a period, up to REBLOCK_MAX */
+static BOOL can_reblock(long block, long period)
+{
+    return block > 0
+        && (block % period == 0 || period % block == 0)
+        && block <= period * REBLOCK_MAX
+        && block * REBLOCK_MAX >= period;
+}
+
+/* Rings and tempbuf for the active channels at a period, in an arena of
+ * their own so that a new set can be made while the audio threads are
+ * still in the old one.  The outputs have reset_rings' silence queued.
+ */
+static BOOL make_rings(IWineASIOImpl *This, RingSet *set, long frames)
+{
+    int count = This->active_inputs + This->active_outputs;
+    int depth = This->pipeline ? MAX_PIPELINE : 0;     /* room for any depth the control socket sets */
+    long most = frames > This->block_frames ? frames : This->block_frames;
+    size_t ring_size;
+    int i;
+
+    for (ring_size = 1; ring_size < (depth > 2 ? depth + 2 : 4) * most * sizeof(float); ring_size <<= 1);
+
+    if (!arena_create(&set->arena, arena_slice(count * sizeof(jack_ringbuffer_t *))
+            + count * (arena_slice(sizeof(jack_ringbuffer_t)) + arena_slice(ring_size))
+            + arena_slice(most * sizeof(float)) + arena_slice(frames * sizeof(float))))
+        return FALSE;
+
+    set->ring = arena_take(&set->arena, count * sizeof(jack_ringbuffer_t *));
+    for (i = 0; i < count; i++)
+        set->ring[i] = ring_take(&set->arena, ring_size);
+    for (i = This->active_inputs; i < count; i++)
+        jack_ringbuffer_write_advance(set->ring[i], ring_prefill(This, frames) * sizeof(float));
+    set->tempbuf = arena_take(&set->arena, most * sizeof(float));
+    set->gain_buf = arena_take(&set->arena, frames * sizeof(float));
+    set->frames = frames;
+
+    if (This->rt_memory && !mem_lock(set->arena.base, set->arena.size))
+        WARN("(%p) couldn't lock the rings, check RLIMIT_MEMLOCK\n", This);
+    return TRUE;
+}
+
+/* point the channels at the current rings */
+static void use_rings(IWineASIOImpl *This)
+{
+    int i;
+
+    for (i = 0; i < This->active_inputs; i++)
+        This->input[i].ring = This->rings.ring[i];
+    for (i = 0; i < This->active_outputs; i++)
+        This->output[i].ring = This->rings.ring[This->active_inputs + i];
+    This->tempbuf = This->rings.tempbuf;
+    This->gain_buf = This->rings.gain_buf;
+}
+
+/* whoever gets swap_frames from a period to -1 does the swap */
+static BOOL claim_swap(IWineASIOImpl *This)
+{
+    long frames = This->swap_frames;
+
+    return frames > 0 && __sync_bool_compare_and_swap(&This->swap_frames, frames, -1);
+}
+
+/* At a cycle boundary, with nobody in the rings: change over to the ones
+ * made for the new period.  The old ones are only freed by the next
+ * change, long after the last audio thread has left them.
+ */
+static void swap_rings(IWineASIOImpl *This)
+{
+    This->old_rings = This->rings;
+    This->rings = This->next_rings;
+    This->next_rings.arena.base = NULL;
+    use_rings(This);
+
+    This->jack_frames = This->rings.frames;
+    This->direct = !This->pipeline && (This->block_frames == This->jack_frames);
+    This->pipeline_frames = 0;
+    This->host_frames = This->stream_frames;    /* what was queued went with the old rings */
+    update_latencies(This);
+
+    __sync_synchronize();
+    This->swap_frames = 0;
+}
+
+WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *sysHandle))
+{
+    IWineASIOImpl *This = (IWineASIOImpl *)iface;
+    jack_status_t status;
+    BOOL futex = FALSE;
+    int spin = 0;
+    int i;
+    TRACE("(%p, %p)\n", iface, sysHandle);
+
+    This->sample_rate = 48000.0;
+    This->block_frames = 1024;
+    This->jack_frames = 1024;
+    This->input_latency = This->block_frames;
+    This->output_latency = This->block_frames;
+    This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
+    This->callbacks = NULL;
+    strcpy(This->error_message, "No Error");
+    This->num_inputs = 0;
+    This->num_outputs = 0;
+    This->active_inputs = 0;
+    This->active_outputs = 0;
+    This->toggle = 0;
+    This->client_state = Init;
+    This->time_info_mode = FALSE;
+    This->tc_read = FALSE;
+    This->direct = FALSE;
+    This->arena.base = NULL;
+    This->rings.arena.base = NULL;
+    This->next_rings.arena.base = NULL;
+    This->old_rings.arena.base = NULL;
+    This->tempbuf = NULL;
+    This->terminate = FALSE;
+    This->state = Init;
+    This->jack_client_priority.sched_priority = -1;
+    This->in_format = This->out_format = SampleInt32;
+    This->in_buffer_format = This->out_buffer_format = SampleInt32;
+    This->sample_auto = FALSE;
+    This->dither = TRUE;
+    convert_seed_dither(This->dither_state);
+    This->rt_memory = TRUE;
+    This->stack_prefault = 256;
+    This->inline_wanted = TRUE;
+    This->inline_callback = FALSE;
+    This->pipeline = 0;
+    This->pipeline_frames = 0;
+    This->pipeline_auto = FALSE;
+    This->latency_changed = FALSE;
+    This->in_callback = FALSE;
+    This->output_posted = FALSE;
+    This->last_block = FALSE;
+    This->exclusive = FALSE;
+    This->notify_thread = NULL;
+    This->period_changed = 0;
+    This->rate_changed = 0;
+    This->swap_frames = 0;
+    This->stats = NULL;
+    This->xrun_pending = 0;
+    This->late_pending = 0;
+    This->output_dropped = 0;
+    This->posted_ns = This->returned_ns = 0;
+    This->recorder = NULL;
+    This->record = NULL;
+    This->dropout_cycle = This->dumped_cycle = 0;
+    This->timeline_wanted = FALSE;
+    This->timeline_size = 256;
+    This->timeline = NULL;
+    This->control_wanted = TRUE;
+    This->control = NULL;
+    This->live.copy[0] = This->live.copy[1] = NULL;
+    This->live_now = NULL;
+    This->gain_buf = NULL;
+    This->panel = NULL;
+    This->capture_latency = 0;
+    This->playback_latency = 0;
+    This->latency_pending = 0;
+    This->timing.seq = 0;
+    This->timing.offset = 0;
+    This->stream_frames = 0;
+    This->host_frames = 0;
+    This->frame_clock = 0;
+    This->stamp.seq = 0;
+    This->stamp.position = This->stamp.ns = 0;
+    sem_init(&This->notify_sem, 0, 0);
+    InitializeCriticalSection(&This->reconfig);
+    pthread_mutex_init(&This->live_lock, NULL);
+    mem_faults_reset(&This->jack_faults);
+    mem_faults_reset(&This->win32_faults);
+
+    TRACE("(%p) sample conversion: %s\n", This, convert_init());
+
+    This->start_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    This->stop_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    set_clientname(This);
+
+#ifndef JackWASIO
+    // uses This->client_name
+    read_config(This);
+    i = get_sampleformat(This, ENVVAR_SAMPLETYPE, SampleInt32);
+    This->in_format = get_sampleformat(This, ENVVAR_INSAMPLETYPE, i);
+    This->out_format = get_sampleformat(This, ENVVAR_OUTSAMPLETYPE, i);
+    This->dither = get_boolean(This, ENVVAR_DITHER, DEFAULT_DITHER);
+    This->rt_memory = get_boolean(This, ENVVAR_RTMEMORY, DEFAULT_RTMEMORY);
+    This->inline_wanted = get_boolean(This, ENVVAR_INLINE, DEFAULT_INLINE);
+    This->exclusive = get_boolean(This, ENVVAR_EXCLUSIVE, DEFAULT_EXCLUSIVE);
+    This->timeline_wanted = get_boolean(This, ENVVAR_TIMELINE, DEFAULT_TIMELINE);
+    This->timeline_size = get_number(This, ENVVAR_TIMELINE_SIZE, DEFAULT_TIMELINE_SIZE);
+    This->control_wanted = get_boolean(This, ENVVAR_CONTROL, DEFAULT_CONTROL);
+    This->pipeline = get_pipeline(This);
+    if (This->pipeline < 0 || This->pipeline > MAX_PIPELINE)
+    {
+        WARN("(%p) pipeline depth %d out of range, using %d\n", This, This->pipeline, DEFAULT_PIPELINE);
+        This->pipeline = DEFAULT_PIPELINE;
+    }
+    This->stack_prefault = get_number(This, ENVVAR_STACKPREFAULT, DEFAULT_STACKPREFAULT);
+    futex = get_futex(This);
+    spin = get_number(This, ENVVAR_SPIN, DEFAULT_SPIN);
+#else
+    ReadJPPrefs();
+#endif
+    handoff_init(&This->wake_win32, futex, spin * 1000L);
+    handoff_init(&This->wake_jack, futex, spin * 1000L);
+    if (futex)
+        TRACE("(%p) handoff: futex, spinning up to %d us\n", This, spin);
+    else
+        TRACE("(%p) handoff: semaphore\n", This);
+    TRACE("(%p) sample types: in %s, out %s%s; dither %s\n", This, converters[This->in_format].name,
+        converters[This->out_format].name, This->sample_auto ? " (auto)" : "", This->dither ? "on" : "off");
+
+    if (This->inline_wanted)
+    {
+        /* looked up, so the driver still loads with a libjack that predates it */
+        void (*set_thread_creator)(jack_thread_creator_t) = dlsym(RTLD_DEFAULT, "jack_set_thread_creator");
+
+        if (set_thread_creator)
+            set_thread_creator(jack_thread_creator);
+        else
+            TRACE("(%p) no jack_set_thread_creator, the callback gets a thread of its own\n", This);
+    }
+
+    This->client = jack_client_open(This->client_name, JackNullOption, &status, NULL);
+    if (This->client == NULL)
+    {
+        WARN("(%p) failed to open jack server\n", This);
+        return ASIOFalse;
+    }
+
+    TRACE("JACK client opened, client name: '%s'; sample rate: %f\n", jack_get_client_name(This->client), This->sample_rate);
+
+    if (status & JackServerStarted)
+        TRACE("(%p) JACK server started\n", This);
+
+    This->stats = stats_open(jack_get_client_name(This->client));
+    if (!This->stats)
+    {
+        MESSAGE("(%p) Not enough memory for the counters\n", This);
+        return ASIOFalse;
+    }
+    if (!This->stats->shared)
+        WARN("(%p) couldn't put the counters in shared memory\n", This);
+
+    This->recorder = recorder_new();
+    if (!This->recorder)
+    {
+        MESSAGE("(%p) Not enough memory for the flight recorder\n", This);
+        return ASIOFalse;
+    }
+    This->record = &This->recorder->record[0];
+
+    if (This->timeline_wanted)
+    {
+        This->timeline = timeline_open(This->stats->client, This->timeline_size);
+        if (!This->timeline)
+            WARN("(%p) couldn't make the timeline file, not tracing\n", This);
+    }
+
+    /* get maximum reccomended client priority from JACK */
+
+    This->jack_client_priority.sched_priority = jack_client_real_time_priority (This->client);
+    This->thread = CreateThread(NULL, 0, win32_callback, (LPVOID)This, 0, &This->thread_id);
+    if (This->thread)
+    {
+        WaitForSingleObject(This->start_event, INFINITE);
+        CloseHandle(This->start_event);
+        This->start_event = INVALID_HANDLE_VALUE;
+    }
+    else
+    {
+        WARN("(%p) Couldn't create thread\n", This);
+        return ASIOFalse;
+    }
+
+    This->notify_thread = CreateThread(NULL, 0, win32_notify, (LPVOID)This, 0, NULL);
+    if (!This->notify_thread)
+        WARN("(%p) Couldn't create the notification thread, period changes will go unannounced\n", This);
+
+    jack_set_thread_init_callback(This->client, jack_thread_init, This);
+    jack_set_process_callback(This->client, jack_process, This);
+    jack_set_buffer_size_callback(This->client, jack_buffer_size, This);
+    jack_set_sample_rate_callback(This->client, jack_sample_rate, This);
+    jack_set_xrun_callback(This->client, jack_xrun, This);
+    jack_set_latency_callback(This->client, jack_latency, This);
+
+    This->sample_rate = jack_get_sample_rate(This->client);
+    This->block_frames = This->jack_frames = jack_get_buffer_size(This->client);
+
+    This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
+    update_latencies(This);
+    if (This->pipeline)
+        TRACE("(%p) decoupled, %d period pipeline%s\n", This, This->pipeline, This->pipeline_auto ? " (auto)" : "");
+    if (This->exclusive)
+        TRACE("(%p) exclusive, JACK's period follows the host's buffer size\n", This);
+
+    This->active_inputs = 0;
+#ifndef JackWASIO
+    This->num_inputs = get_numChannels(This, ENVVAR_INPUTS, DEFAULT_NUMINPUTS);
+#else
+    This->num_inputs = MAX_INPUTS;
+#endif
+    This->input = HeapAlloc(GetProcessHeap(), 0, sizeof(Channel) * This->num_inputs);
+    if (!This->input)
+    {
+        MESSAGE("(%p) Not enough memory for %d input channels\n", This, This->num_inputs);
+        return ASIOFalse;
+    }
+    TRACE("(%p) Max inputs: %d\n", This, This->num_inputs);
+    for (i = 0; i < This->num_inputs; i++)
+    {
+        This->input[i].active = ASIOFalse;
+        This->input[i].buffer = NULL;
+        set_portname(This, ENVVAR_INPORTNAMEPREFIX, DEFAULT_INPORT, i, This->input);
+        TRACE("(%p) input %d: '%s'\n", This, i, This->input[i].port_name);
+
+        This->input[i].port = jack_port_register(This->client,
+            This->input[i].port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+        if (This->input[i].port)
+            TRACE("(%p) Registered input port %i: '%s' (%p)\n", This, i, This->input[i].port_name, This->input[i].port);
+        else {
+            MESSAGE("(%p) Failed to register input port %i ('%s')\n", This, i, This->input[i].port_name);
+            return ASE_NotPresent;
+        }
+        This->input[i].ring = NULL;
+    }
+
+    This->active_outputs = 0;
+#ifndef JackWASIO
+    This->num_outputs = get_numChannels(This, ENVVAR_OUTPUTS, DEFAULT_NUMOUTPUTS);
+#else
+    This->num_outputs = MAX_OUTPUTS;
+#endif
+    This->output =  HeapAlloc(GetProcessHeap(), 0, sizeof(Channel) * This->num_outputs);
+    if (!This->output)
+    {
+        MESSAGE("(%p) Not enough memory for %d output channels\n", This, This->num_outputs);
+        return ASIOFalse;
+    }
+    TRACE("(%p) Max outputs: %d\n", This, This->num_outputs);
+    for (i = 0; i < This->num_outputs; i++)
+    {
+        This->output[i].active = ASIOFalse;
+        This->output[i].buffer = NULL;
+        set_portname(This, ENVVAR_OUTPORTNAMEPREFIX, DEFAULT_OUTPORT, i, This->output);
+        TRACE("(%p) output %d: '%s'\n", This, i, This->output[i].port_name);
+
+        This->output[i].port = jack_port_register(This->client, 
+            This->output[i].port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (This->output[i].port)
+            TRACE("(%p) Registered output port %i: '%s' (%p)\n", This, i, This->output[i].port_name, This->output[i].port);
+        else {
+            MESSAGE("(%p) Failed to register output port %i ('%s')\n", This, i, This->output[i].port_name);
+            return ASE_NotPresent;
+        }
+        This->output[i].ring = NULL;
+    }
+
+    if (!init_live(This))
+    {
+        MESSAGE("(%p) Not enough memory for the live settings\n", This);
+        return ASIOFalse;
+    }
+    if (This->control_wanted)
+    {
+        This->control = control_open(This->stats->client, control_command, This);
+        if (!This->control)
+            WARN("(%p) couldn't make the control socket\n", This);
+        else
+            TRACE("(%p) control socket %s\n", This, This->control->path);
+    }
+
+    return ASIOTrue;
+}
+
+WRAP_THISCALL( void __stdcall, IWineASIOImpl_getDriverName, (LPWINEASIO iface, char *name))
+{
+    TRACE("(%p, %p)\n", iface, name);
+    strcpy(name, "Wine ASIO");
+}
+
+WRAP_THISCALL( long __stdcall, IWineASIOImpl_getDriverVersion, (LPWINEASIO iface))
+{
+    TRACE("(%p)\n", iface);
+    return 80; // 0.8 (patch level 0)
+}
+
+WRAP_THISCALL( void __stdcall, IWineASIOImpl_getErrorMessage, (LPWINEASIO iface, char *string))
 {
     IWineASIOImpl * This = (IWineASIOImpl*)iface;
     TRACE("(%p, %p)\n", iface, string);
@@ -742,9 +1784,10 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_start, (LPWINEASIO iface))
 
     if (This->callbacks)
     {
-        This->sample_position = 0;
-        This->system_time.lo = 0;
-        This->system_time.hi = 0;
+        stamp_set(&This->stamp, 0, 0);
+        This->stream_frames = 0;
+        This->host_frames = 0;
+        calibrate_timing(This);
 
         if (jack_activate(This->client))
         {
@@ -815,6 +1858,12 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_start, (LPWINEASIO iface))
         if (ports)
             free(ports);
 
+        mem_faults_reset(&This->jack_faults);
+        mem_faults_reset(&This->win32_faults);
+        reset_rings(This);
+        This->tune_cycles = This->tune_clean = 0;
+        This->tune_misses = 0;
+
         This->state = Run;
         TRACE("started\n");
 
@@ -834,6 +1883,13 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_stop, (LPWINEASIO iface))
         WARN("couldn't deactivate client\n");
         return ASE_NotPresent;
     }
+    This->state = Init;
+
+    if (This->rt_memory)
+        TRACE("(%p) page faults while running: JACK thread %ld minor %ld major, win32 thread %ld minor %ld major\n", This,
+            This->jack_faults.minor, This->jack_faults.major, This->win32_faults.minor, This->win32_faults.major);
+    TRACE("(%p) %llu cycles, %u xruns, %u late callbacks so far\n", This,
+        This->stats->cycles, This->stats->xruns, This->stats->late);
 
     return ASE_OK;
 }
@@ -868,24 +1924,45 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getLatencies, (LPWINEASIO ifac
     return ASE_OK;
 }
 
+/* Host buffers may be JACK's period, or that times or divided by a power
+ * of two up to REBLOCK_MAX; the rings make up the difference.  Exclusive,
+ * any power of two JACK takes, as that becomes the period.
+ */
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getBufferSize, (LPWINEASIO iface, long *minSize, long *maxSize, long *preferredSize, long *granularity))
 {
     IWineASIOImpl * This = (IWineASIOImpl*)iface;
+    long period = jack_get_buffer_size(This->client);
+    long min = period, max = period, gran = 0;
     TRACE("(%p, %p, %p, %p, %p)\n", iface, minSize, maxSize, preferredSize, granularity);
 
+    if (This->exclusive)
+    {
+        min = REBLOCK_MIN;
+        max = EXCLUSIVE_MAX;
+        gran = -1;
+    }
+    /* only a power of two period makes the powers of two granularity true */
+    else if ((period & (period - 1)) == 0)
+    {
+        while (min > REBLOCK_MIN && min > period / REBLOCK_MAX)
+            min /= 2;
+        max = period * REBLOCK_MAX;
+        gran = -1;
+    }
+
     if (minSize)
-        *minSize = This->block_frames;
+        *minSize = min;
 
     if (maxSize)
-        *maxSize = This->block_frames;
+        *maxSize = max;
 
     if (preferredSize)
-        *preferredSize = This->block_frames;
+        *preferredSize = period;
 
     if (granularity)
-        *granularity = 0;
+        *granularity = gran;
 
-    TRACE("min: %ld max: %ld preferred: %ld granularity: 0\n", This->block_frames, This->block_frames, This->block_frames);
+    TRACE("min: %ld max: %ld preferred: %ld granularity: %ld\n", min, max, period, gran);
 
     return ASE_OK;
 }
@@ -962,21 +2039,14 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_setClockSource, (LPWINEASIO if
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getSamplePosition, (LPWINEASIO iface, ASIOSamples *sPos, ASIOTimeStamp *tStamp))
 {
     IWineASIOImpl * This = (IWineASIOImpl*)iface;
+    long long position, ns;
 //  TRACE("(%p, %p, %p)\n", iface, sPos, tStamp);
 
-    tStamp->lo = This->system_time.lo;
-    tStamp->hi = This->system_time.hi;
-
-    if (This->sample_position >= twoRaisedTo32)
-    {
-        sPos->hi = (unsigned long)(This->sample_position * twoRaisedTo32Reciprocal);
-        sPos->lo = (unsigned long)(This->sample_position - (sPos->hi * twoRaisedTo32));
-    }
-    else
-    {
-        sPos->hi = 0;
-        sPos->lo = (unsigned long)This->sample_position;
-    }
+    stamp_get(&This->stamp, &position, &ns);
+    tStamp->hi = (unsigned long)((unsigned long long)ns >> 32);
+    tStamp->lo = (unsigned long)(ns & 0xffffffff);
+    sPos->hi = (unsigned long)((unsigned long long)position >> 32);
+    sPos->lo = (unsigned long)(position & 0xffffffff);
 
     return ASE_OK;
 }
@@ -994,7 +2064,7 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getChannelInfo, (LPWINEASIO if
 //  TRACE("info->channel = %ld\n", info->channel);
 //  TRACE("info->isInput = %ld\n", info->isInput);
 
-    info->type = ASIOSTInt32LSB; //  info->type = This->sample_type;
+    info->type = asio_sample_types[info->isInput ? This->in_format : This->out_format];
     info->channelGroup = 0;
 
     if (info->isInput)
@@ -1030,30 +2100,34 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_disposeBuffers, (LPWINEASIO if
     IWineASIOImpl * This = (IWineASIOImpl*)iface;
     TRACE("(%p)\n", iface);
 
+    EnterCriticalSection(&This->reconfig);
     This->callbacks = NULL;
     __wrapped_IWineASIOImpl_stop(iface);
 
-    for (i = This->active_inputs; --i >= 0; )
+    for (i = 0; i < This->num_inputs; i++)
     {
-        if (This->input[i].active)
-        {
-            HeapFree(GetProcessHeap(), 0, This->input[i].buffer);
-            This->input[i].buffer = NULL;
-            This->input[i].active = ASIOFalse;
-        }
-        This->active_inputs--;
+        This->input[i].buffer = NULL;
+        This->input[i].ring = NULL;
+        This->input[i].active = ASIOFalse;
     }
+    This->active_inputs = 0;
 
-    for (i = This->active_outputs; --i >= 0; )
+    for (i = 0; i < This->num_outputs; i++)
     {
-        if (This->output[i].active)
-        {
-            HeapFree(GetProcessHeap(), 0, This->output[i].buffer);
-            This->output[i].buffer = NULL;
-            This->output[i].active = ASIOFalse;
-        }
-        This->active_outputs--;
+        This->output[i].buffer = NULL;
+        This->output[i].ring = NULL;
+        This->output[i].active = ASIOFalse;
     }
+    This->active_outputs = 0;
+
+    This->tempbuf = NULL;
+    This->gain_buf = NULL;
+    arena_destroy(&This->arena);
+    arena_destroy(&This->rings.arena);
+    arena_destroy(&This->next_rings.arena);
+    arena_destroy(&This->old_rings.arena);
+    This->swap_frames = 0;
+    LeaveCriticalSection(&This->reconfig);
 
     return ASE_OK;
 }
@@ -1062,17 +2136,59 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
 {
     IWineASIOImpl * This = (IWineASIOImpl*)iface;
     ASIOBufferInfo * info = bufferInfos;
-    int i, j;
+    size_t in_size, out_size, total;
+    int i, in, out;
     TRACE("(%p, %p, %ld, %ld, %p)\n", iface, bufferInfos, numChannels, bufferSize, callbacks);
 
+    /* keeps the notification thread out until the buffers are complete */
+    EnterCriticalSection(&This->reconfig);
+
     // Just to be on the safe side:
     This->active_inputs = 0;
     for(i = 0; i < This->num_inputs; i++) This->input[i].active = ASIOFalse;
     This->active_outputs = 0;
     for(i = 0; i < This->num_outputs; i++) This->output[i].active = ASIOFalse;
 
+    /* whatever JACK has changed to since, the new buffers are made for what it runs at now */
+    This->period_changed = 0;
+    This->jack_frames = jack_get_buffer_size(This->client);
+
+    /* Exclusive: have JACK run at the host's size instead of reblocking.
+     * Set first, so jack_buffer_size takes the change for our own.
+     */
+    if (This->exclusive && bufferSize > 0 && bufferSize != This->jack_frames)
+    {
+        long period = This->jack_frames;
+
+        This->jack_frames = bufferSize;
+        if (jack_set_buffer_size(This->client, bufferSize))
+        {
+            WARN("(%p) JACK won't run at %ld frames, reblocking to its %ld instead\n", This, bufferSize, period);
+            This->jack_frames = period;
+        }
+        else
+            TRACE("(%p) JACK's period set to %ld frames\n", This, bufferSize);
+    }
+
+    if (!can_reblock(bufferSize, This->jack_frames))
+    {
+        WARN("(%p) can't reblock %ld frames to JACK's %ld\n", This, bufferSize, This->jack_frames);
+        LeaveCriticalSection(&This->reconfig);
+        return ASE_InvalidMode;
+    }
+
+    /* the rings are only needed when the host's buffer is not JACK's period, or to decouple */
+    This->direct = !This->pipeline && (bufferSize == This->jack_frames);
+    TRACE("(%p) %s mode, %ld frame host buffer over %ld frame periods\n", This,
+        This->direct ? "direct" : "ring buffer", bufferSize, This->jack_frames);
+
     This->block_frames = bufferSize;
     This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
+    update_latencies(This);
+
+    /* the host has already asked getChannelInfo for the type, so these buffers hold that */
+    This->in_buffer_format = This->in_format;
+    This->out_buffer_format = This->out_format;
 
     for (i = 0; i < numChannels; i++, info++)
     {
@@ -1090,23 +2206,6 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
                 goto ERROR_PARAM;
             }
 
-// ASIOSTInt32LSB support only
-            This->input[This->active_inputs].buffer = HeapAlloc(GetProcessHeap(), 0, 2 * This->block_frames * sizeof(int));
-            if (This->input[This->active_inputs].buffer)
-            {
-                info->buffers[0] = &This->input[This->active_inputs].buffer[0];
-                info->buffers[1] = &This->input[This->active_inputs].buffer[This->block_frames];
-                for (j = 0; j < This->block_frames * 2; j++)
-                    This->input[This->active_inputs].buffer[j] = 0;
-            }
-            else
-            {
-                HeapFree(GetProcessHeap(), 0, This->input[This->active_inputs].buffer);
-                info->buffers[0] = 0;
-                info->buffers[1] = 0;
-                WARN("no input buffer memory\n");
-                goto ERROR_MEM;
-            }
             This->input[This->active_inputs].active = ASIOTrue;
             This->active_inputs++;
         }
@@ -1124,28 +2223,50 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
                 goto ERROR_PARAM;
             }
 
-// ASIOSTInt32LSB support only
-            This->output[This->active_outputs].buffer = HeapAlloc(GetProcessHeap(), 0, 2 * This->block_frames * sizeof(int));
-            if (This->output[This->active_outputs].buffer)
-            {
-                info->buffers[0] = &This->output[This->active_outputs].buffer[0];
-                info->buffers[1] = &This->output[This->active_outputs].buffer[This->block_frames];
-                for (j = 0; j < This->block_frames * 2; j++)
-                    This->output[This->active_outputs].buffer[j] = 0;
-            }
-            else
-            {
-                HeapFree(GetProcessHeap(), 0, This->output[This->active_inputs].buffer);
-                info->buffers[0] = 0;
-                info->buffers[1] = 0;
-                WARN("no input buffer memory\n");
-                goto ERROR_MEM;
-            }
             This->output[This->active_outputs].active = ASIOTrue;
             This->active_outputs++;
         }
     }
 
+    /* The ASIO buffers of the active channels come out of one arena, one
+     * channel after another so the callback sweeps through them in order.
+     * Inactive ports get nothing.
+     */
+    in_size = 2 * This->block_frames * converters[This->in_buffer_format].size;
+    out_size = 2 * This->block_frames * converters[This->out_buffer_format].size;
+    total = This->active_inputs * arena_slice(in_size) + This->active_outputs * arena_slice(out_size);
+
+    if (!arena_create(&This->arena, total))
+    {
+        WARN("no buffer memory\n");
+        goto ERROR_MEM;
+    }
+    TRACE("(%p) %lu byte buffer arena%s\n", This, (unsigned long)This->arena.size, This->arena.huge ? " on huge pages" : "");
+
+    for (i = 0; i < This->active_inputs; i++)
+        This->input[i].buffer = arena_take(&This->arena, in_size);
+    for (i = 0; i < This->active_outputs; i++)
+        This->output[i].buffer = arena_take(&This->arena, out_size);
+
+    /* direct mode still gets rings, jack_process falls back to them if the period changes */
+    if (!make_rings(This, &This->rings, This->jack_frames))
+    {
+        WARN("no ring memory\n");
+        goto ERROR_MEM;
+    }
+    use_rings(This);
+
+    if (This->rt_memory)
+        lock_memory(This);
+
+    for (i = 0, in = out = 0, info = bufferInfos; i < numChannels; i++, info++)
+    {
+        Channel *c = info->isInput ? &This->input[in++] : &This->output[out++];
+
+        info->buffers[0] = c->buffer;
+        info->buffers[1] = c->buffer + (info->isInput ? in_size : out_size) / 2;
+    }
+
     This->callbacks = callbacks;
 
     if (This->callbacks->asioMessage)
@@ -1159,7 +2280,7 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
             This->asio_time.timeInfo.samplePosition.hi = 0;
             This->asio_time.timeInfo.samplePosition.lo = 0;
             This->asio_time.timeInfo.sampleRate = This->sample_rate;
-            This->asio_time.timeInfo. flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid;
+            This->asio_time.timeInfo. flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid | kSpeedValid;
 
             This->asio_time.timeCode.speed = 1;
             This->asio_time.timeCode.timeCodeSamples.hi = 0;
@@ -1168,6 +2289,21 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
         }
         else
             This->time_info_mode = FALSE;
+
+        /* float32 only arrived with ASIO 2.0; ask an older host to reset and see int32 instead */
+        if (This->sample_auto
+            && This->callbacks->asioMessage(kAsioSelectorSupported, kAsioEngineVersion, 0, 0)
+            && This->callbacks->asioMessage(kAsioEngineVersion, 0, 0, 0) < 2)
+        {
+            TRACE("(%p) pre-ASIO 2.0 host, falling back to int32\n", This);
+            if (This->in_format == SampleFloat32)
+                This->in_format = SampleInt32;
+            if (This->out_format == SampleFloat32)
+                This->out_format = SampleInt32;
+            This->sample_auto = FALSE;
+            if (This->callbacks->asioMessage(kAsioSelectorSupported, kAsioResetRequest, 0, 0))
+                This->callbacks->asioMessage(kAsioResetRequest, 0, 0, 0);
+        }
     }
     else
     {
@@ -1176,130 +2312,590 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
         goto ERROR_PARAM;
     }
 
-    return ASE_OK;
+    LeaveCriticalSection(&This->reconfig);
+    return ASE_OK;
+
+ERROR_MEM:
+    __wrapped_IWineASIOImpl_disposeBuffers(iface);
+    LeaveCriticalSection(&This->reconfig);
+    WARN("no memory\n");
+    return ASE_NoMemory;
+
+ERROR_PARAM:
+    __wrapped_IWineASIOImpl_disposeBuffers(iface);
+    LeaveCriticalSection(&This->reconfig);
+    WARN("invalid parameter\n");
+    return ASE_InvalidParameter;
+}
+
+/* Our own window, rather than starting qjackctl from inside the host */
+WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_controlPanel, (LPWINEASIO iface))
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)iface;
+    TRACE("(%p)\n", iface);
+
+    if (This->panel && panel_raise(This->panel))
+        return ASE_OK;
+
+    /* closed since: its thread has finished */
+    panel_close(This->panel);
+    This->panel = panel_open(This->stats, &panel_ops, This);
+    if (!This->panel)
+    {
+        WARN("(%p) couldn't open the control panel\n", This);
+        return ASE_NotPresent;
+    }
+    return ASE_OK;
+}
+
+WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_future, (LPWINEASIO iface, long selector, void *opt))
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)iface;
+    TRACE("(%p, %ld, %p)\n", iface, selector, opt);
+
+    switch (selector)
+    {
+    case kAsioEnableTimeCodeRead:
+        This->tc_read = TRUE;
+        return ASE_SUCCESS;
+    case kAsioDisableTimeCodeRead:
+        This->tc_read = FALSE;
+        return ASE_SUCCESS;
+    case kAsioSetInputMonitor:
+        return ASE_SUCCESS;
+    case kAsioCanInputMonitor:
+        return ASE_SUCCESS;
+    case kAsioCanTimeInfo:
+        return ASE_SUCCESS;
+    case kAsioCanTimeCode:
+        return ASE_SUCCESS;
+    }
+
+    return ASE_NotPresent;
+}
+
+static void write_rings(IWineASIOImpl *This);
+
+/* Hosts call this once after createBuffers to see if we support it, and
+ * then at the end of each bufferSwitch, as soon as their output is written.
+ */
+WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_outputReady, (LPWINEASIO iface))
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)iface;
+
+    if (!This->in_callback)
+    {
+        TRACE("(%p)\n", iface);
+        return ASE_OK;
+    }
+
+    /* let a waiting JACK thread have this cycle's output now, not after the host unwinds */
+    if (!This->inline_callback && !This->pipeline && !This->output_posted && (This->direct || This->last_block))
+    {
+        if (!This->direct)
+            write_rings(This);
+        This->output_posted = TRUE;
+        This->returned_ns = stats_now();
+        handoff_post(&This->wake_jack);
+    }
+
+    return ASE_OK;
+}
+
+static const IWineASIOVtbl WineASIO_Vtbl =
+{
+    IWineASIOImpl_QueryInterface,
+    IWineASIOImpl_AddRef,
+    IWineASIOImpl_Release,
+    IWineASIOImpl_init,
+    IWineASIOImpl_getDriverName,
+    IWineASIOImpl_getDriverVersion,
+    IWineASIOImpl_getErrorMessage,
+    IWineASIOImpl_start,
+    IWineASIOImpl_stop,
+    IWineASIOImpl_getChannels,
+    IWineASIOImpl_getLatencies,
+    IWineASIOImpl_getBufferSize,
+    IWineASIOImpl_canSampleRate,
+    IWineASIOImpl_getSampleRate,
+    IWineASIOImpl_setSampleRate,
+    IWineASIOImpl_getClockSources,
+    IWineASIOImpl_setClockSource,
+    IWineASIOImpl_getSamplePosition,
+    IWineASIOImpl_getChannelInfo,
+    IWineASIOImpl_createBuffers,
+    IWineASIOImpl_disposeBuffers,
+    IWineASIOImpl_controlPanel,
+    IWineASIOImpl_future,
+    IWineASIOImpl_outputReady,
+};
+
+HRESULT asioCreateInstance(REFIID riid, LPVOID *ppobj)
+{
+    IWineASIOImpl * pobj;
+    TRACE("(%s, %p)\n", debugstr_guid(riid), ppobj);
+
+    pobj = HeapAlloc(GetProcessHeap(), 0, sizeof(*pobj));
+    if (pobj == NULL) {
+        WARN("out of memory\n");
+        return E_OUTOFMEMORY;
+    }
+
+    pobj->lpVtbl = &WineASIO_Vtbl;
+    pobj->ref = 1;
+    TRACE("pobj = %p\n", pobj);
+    *ppobj = pobj;
+    TRACE("return %p\n", *ppobj);
+    return S_OK;
+}
+
+/* A stage's time, ending at end, for the histograms, this cycle's
+ * record and the timeline
+ */
+static void stage_end(IWineASIOImpl *This, int s, long long end, long long ns)
+{
+    stats_stage(This->stats, s, ns);
+    This->record->stage[s] += (int)ns;
+    if (This->timeline)
+        timeline_span(This->timeline, s, end - ns, ns);
+}
+
+/* one that ended just now; the clock is only read for the timeline */
+static void stage(IWineASIOImpl *This, int s, long long ns)
+{
+    stage_end(This, s, This->timeline ? stats_now() : 0, ns);
+}
+
+static long long lap(IWineASIOImpl *This, int s, long long since)
+{
+    long long now = stats_now();
+
+    stage_end(This, s, now, now - since);
+    return now;
+}
+
+/* An input with its gain, in gain_buf unless it's unity: JACK's buffer
+ * may well be another client's output, so it is never scaled in place
+ */
+static const float *gain_input(IWineASIOImpl *This, int i, const float *in, jack_nframes_t nframes)
+{
+    float gain = This->live_now->gain[i];
+    jack_nframes_t j;
+
+    /* only ever a period of the rings', which have gain_buf sized for it */
+    if (gain == 1.0f)
+        return in;
+    for (j = 0; j < nframes; j++)
+        This->gain_buf[j] = in[j] * gain;
+    return This->gain_buf;
+}
+
+/* the outputs are ours to scale where they are */
+static void gain_outputs(IWineASIOImpl *This, jack_nframes_t nframes)
+{
+    const float *gain = &This->live_now->gain[This->num_inputs];
+    float *out;
+    jack_nframes_t j;
+    int i;
+
+    for (i = 0; i < This->active_outputs; i++)
+    {
+        if (gain[i] == 1.0f)
+            continue;
+        out = jack_port_get_buffer(This->output[i].port, nframes);
+        for (j = 0; j < nframes; j++)
+            out[j] *= gain[i];
+    }
+}
+
+/* the output is out, from t: the cycle is over */
+static void end_cycle(IWineASIOImpl *This, jack_nframes_t nframes, long long start, long long t)
+{
+    gain_outputs(This, nframes);
+    t = lap(This, STAGE_OUTPUT, t);
+    stage_end(This, STAGE_CYCLE, t, t - start);
+    PROBE2(cycle_end, This->stats->client, nframes);
+}
+
+/* The host's next block: its first frame's position in JACK's frame
+ * time, and when it came in, in nanoseconds of the timeGetTime() time
+ * base ASIO has timestamps in
+ */
+static void stamp_block(IWineASIOImpl *This, Cycle *cycle)
+{
+    timing_read(&This->timing, cycle);
+    stamp_set(&This->stamp, timing_position(cycle, This->host_frames),
+        timing_ns(&This->timing, cycle, This->host_frames));
+}
+
+/* The timecode a host asks for with kAsioEnableTimeCodeRead follows JACK's
+ * transport: its frame at the block's first, running at nominal speed or
+ * standing still
+ */
+static void block_timecode(IWineASIOImpl *This, const Cycle *cycle)
+{
+    ASIOTimeCode *tc = &This->asio_time.timeCode;
+    unsigned long long frame = timing_transport(cycle, This->host_frames);
+
+    tc->timeCodeSamples.hi = (unsigned long)(frame >> 32);
+    tc->timeCodeSamples.lo = (unsigned long)(frame & 0xffffffff);
+    if (cycle->rolling)
+    {
+        tc->speed = 1;
+        tc->flags = kTcValid | kTcRunning | kTcOnspeed | kTcSpeedValid;
+    }
+    else
+    {
+        tc->speed = 0;
+        tc->flags = kTcValid | kTcStill | kTcSpeedValid;
+    }
+}
+
+/* ring buffer mode: the JACK side of the rings to the ASIO buffers */
+static void read_rings(IWineASIOImpl *This)
+{
+    const Converter *conv = &converters[This->in_buffer_format];
+    int i;
+
+    PROBE2(ring_read, This->stats->client, This->block_frames);
+    for (i = 0; i < This->active_inputs; i++) {
+        if (This->input[i].active == ASIOTrue) {
+            char *buffer = &This->input[i].buffer[This->block_frames * This->toggle * conv->size];
+
+            if (This->in_buffer_format == SampleFloat32)
+                jack_ringbuffer_read(This->input[i].ring, buffer, This->block_frames * sizeof(float));
+            else
+            {
+                jack_ringbuffer_read(This->input[i].ring, (char*)This->tempbuf, This->block_frames * sizeof(float));
+                conv->from_float(buffer, This->tempbuf, This->block_frames, This->dither ? This->dither_state : NULL);
+            }
+        }
+    }
+    PROBE2(ring_read_done, This->stats->client, This->block_frames);
+}
+
+/* The least room, in bytes, any of the first count channels' rings has.
+ * A ring holds a byte less than its size, so a write that doesn't fit
+ * would store part of a sample; the writers drop whole blocks instead.
+ */
+static size_t rings_room(const Channel *c, int count)
+{
+    size_t room = (size_t)-1, space;
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (c[i].ring && (space = jack_ringbuffer_write_space(c[i].ring)) < room)
+            room = space;
+    return room;
+}
+
+/* and the ASIO buffers back into the rings */
+static void write_rings(IWineASIOImpl *This)
+{
+    const Converter *conv = &converters[This->out_buffer_format];
+    int i;
+
+    /* a host catching up faster than JACK plays: lose this block, the JACK thread counts it */
+    if (rings_room(This->output, This->active_outputs) < This->block_frames * sizeof(float))
+    {
+        This->output_dropped = 1;
+        return;
+    }
+
+    PROBE2(ring_write, This->stats->client, This->block_frames);
+    for (i = 0; i < This->num_outputs; i++) {
+        if (This->output[i].active == ASIOTrue) {
+            char *buffer = &This->output[i].buffer[This->block_frames * This->toggle * conv->size];
+
+            if (This->out_buffer_format == SampleFloat32)
+                jack_ringbuffer_write(This->output[i].ring, buffer, This->block_frames * sizeof(float));
+            else
+            {
+                conv->to_float(This->tempbuf, buffer, This->block_frames);
+                jack_ringbuffer_write(This->output[i].ring, (char*)This->tempbuf, This->block_frames * sizeof(float));
+            }
+        }
+    }
+    PROBE2(ring_write_done, This->stats->client, This->block_frames);
+}
+
+/* the host's callback; has to run on a win32 thread */
+static void buffer_switch(IWineASIOImpl *This)
+{
+    Cycle cycle;
+    long long t;
+
+    stamp_block(This, &cycle);
+    if (This->time_info_mode)
+    {
+        __wrapped_IWineASIOImpl_getSamplePosition((LPWINEASIO)This,
+            &This->asio_time.timeInfo.samplePosition, &This->asio_time.timeInfo.systemTime);
+        if (This->tc_read)
+            block_timecode(This, &cycle);
+    }
+    This->host_frames += This->block_frames;
+
+    PROBE2(callback_start, This->stats->client, This->toggle);
+    t = stats_now();
+    if (This->time_info_mode)
+    {
+        This->in_callback = TRUE;
+        This->callbacks->bufferSwitchTimeInfo(&This->asio_time, This->toggle, ASIOTrue);
+        This->in_callback = FALSE;
+        This->asio_time.timeInfo.flags &= ~(kSampleRateChanged | kClockSourceChanged);
+    }
+    else
+    {
+        This->in_callback = TRUE;
+        This->callbacks->bufferSwitch(This->toggle, ASIOTrue);
+        This->in_callback = FALSE;
+    }
+    lap(This, STAGE_CALLBACK, t);
+    PROBE2(callback_end, This->stats->client, This->toggle);
+}
+
+/* Ring buffer mode: a callback for each whole block JACK has queued.
+ * Those are taken off pipeline_frames first, so a JACK thread that
+ * outputReady lets go early finds only what it adds itself.
+ */
+static void process_blocks(IWineASIOImpl *This)
+{
+    long blocks = This->pipeline_frames / This->block_frames;
+    long long t, convert;
+
+    __sync_fetch_and_sub(&This->pipeline_frames, blocks * This->block_frames);
+    while (blocks-- > 0)
+    {
+        t = stats_now();
+        read_rings(This);
+        convert = stats_now() - t;
+        This->last_block = (blocks == 0);
+        buffer_switch(This);
+        if (!This->output_posted)
+        {
+            t = stats_now();
+            write_rings(This);
+            convert += stats_now() - t;
+        }
+        stage(This, STAGE_CONVERT, convert);
+        This->toggle = This->toggle ? 0 : 1;
+    }
+}
+
+/* Have the callback done: right here if JACK's thread is a win32 one,
+ * otherwise by waking the win32 thread and waiting for it.
+ */
+static void run_callback(IWineASIOImpl *This)
+{
+    if (!This->inline_callback)
+    {
+        This->posted_ns = stats_now();
+        handoff_post(&This->wake_win32);
+        handoff_wait(&This->wake_jack);
+        lap(This, STAGE_RETURN, This->returned_ns);
+        return;
+    }
+
+    if (This->direct)
+        buffer_switch(This);
+    else
+        process_blocks(This);
+}
+
+/* Runs in JACK's process thread before its first cycle.  Unless that
+ * is a win32 thread it must not call into Wine, TRACE included.
+ */
+static void jack_thread_init(void * arg)
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
 
-ERROR_MEM:
-    __wrapped_IWineASIOImpl_disposeBuffers(iface);
-    WARN("no memory\n");
-    return ASE_NoMemory;
+    This->inline_callback = This->inline_wanted && win32_thread && !This->pipeline;
 
-ERROR_PARAM:
-    __wrapped_IWineASIOImpl_disposeBuffers(iface);
-    WARN("invalid parameter\n");
-    return ASE_InvalidParameter;
+    if (This->rt_memory)
+        mem_prefault_stack(This->stack_prefault * 1024);
 }
 
-WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_controlPanel, (LPWINEASIO iface))
+/* Runs in whichever of JACK's threads it likes, before the first cycle
+ * at the new period; the notification thread makes the new rings and
+ * does the talking.  A change we asked for ourselves is no news.
+ */
+static int jack_buffer_size(jack_nframes_t nframes, void * arg)
 {
-    char* arg_list[] = { "qjackctl", NULL };
-
-    TRACE ("Opening ASIO control panel\n");
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
 
-    if (fork() == 0)
-        execvp (arg_list[0], arg_list);
-    return ASE_OK;
+    if ((long)nframes != This->jack_frames)
+    {
+        This->period_changed = nframes;
+        sem_post(&This->notify_sem);
+    }
+    return 0;
 }
 
-WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_future, (LPWINEASIO iface, long selector, void *opt))
+/* the same for the sample rate, which JACK also reports on activation */
+static int jack_sample_rate(jack_nframes_t nframes, void * arg)
 {
-    IWineASIOImpl * This = (IWineASIOImpl*)iface;
-    TRACE("(%p, %ld, %p)\n", iface, selector, opt);
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
 
-    switch (selector)
+    if ((ASIOSampleRate)nframes != This->sample_rate)
     {
-    case kAsioEnableTimeCodeRead:
-        This->tc_read = TRUE;
-        return ASE_SUCCESS;
-    case kAsioDisableTimeCodeRead:
-        This->tc_read = FALSE;
-        return ASE_SUCCESS;
-    case kAsioSetInputMonitor:
-        return ASE_SUCCESS;
-    case kAsioCanInputMonitor:
-        return ASE_SUCCESS;
-    case kAsioCanTimeInfo:
-        return ASE_SUCCESS;
-    case kAsioCanTimeCode:
-        return ASE_SUCCESS;
+        This->rate_changed = nframes;
+        sem_post(&This->notify_sem);
     }
+    return 0;
+}
 
-    return ASE_NotPresent;
+/* Start this cycle's record with what the JACK thread knows at the top of it */
+static void record_cycle(IWineASIOImpl *This, jack_nframes_t nframes, long long start)
+{
+    Record *r = recorder_begin(This->recorder, This->stats->cycles);
+
+    r->start = start;
+    r->nframes = nframes;
+    r->inputs = This->active_inputs;
+    r->outputs = This->active_outputs;
+    r->state = This->state;
+    r->client_state = This->client_state;
+    r->direct = This->direct;
+    r->toggle = This->toggle;
+    r->queued = This->pipeline_frames;
+    r->to_win32 = handoff_pending(&This->wake_win32);
+    r->to_jack = handoff_pending(&This->wake_jack);
+    This->record = r;
 }
 
-WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_outputReady, (LPWINEASIO iface))
+/* JACK has seen an xrun somewhere in the graph; the host gets kAsioResyncRequest */
+static int jack_xrun(void * arg)
 {
-    TRACE("(%p)\n", iface);
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
 
-    return ASE_NotPresent;
+    This->stats->xruns++;
+    This->dropout_cycle = This->stats->cycles;
+    if (This->state == Run)
+    {
+        This->xrun_pending = 1;
+        sem_post(&This->notify_sem);
+    }
+    return 0;
 }
 
-static const IWineASIOVtbl WineASIO_Vtbl =
+/* and for ours, the host not being done in time, kAsioOverload */
+static void note_late(IWineASIOImpl *This)
 {
-    IWineASIOImpl_QueryInterface,
-    IWineASIOImpl_AddRef,
-    IWineASIOImpl_Release,
-    IWineASIOImpl_init,
-    IWineASIOImpl_getDriverName,
-    IWineASIOImpl_getDriverVersion,
-    IWineASIOImpl_getErrorMessage,
-    IWineASIOImpl_start,
-    IWineASIOImpl_stop,
-    IWineASIOImpl_getChannels,
-    IWineASIOImpl_getLatencies,
-    IWineASIOImpl_getBufferSize,
-    IWineASIOImpl_canSampleRate,
-    IWineASIOImpl_getSampleRate,
-    IWineASIOImpl_setSampleRate,
-    IWineASIOImpl_getClockSources,
-    IWineASIOImpl_setClockSource,
-    IWineASIOImpl_getSamplePosition,
-    IWineASIOImpl_getChannelInfo,
-    IWineASIOImpl_createBuffers,
-    IWineASIOImpl_disposeBuffers,
-    IWineASIOImpl_controlPanel,
-    IWineASIOImpl_future,
-    IWineASIOImpl_outputReady,
-};
+    This->stats->late++;
+    This->dropout_cycle = This->stats->cycles;
+    This->late_pending = 1;
+    sem_post(&This->notify_sem);
+}
 
-HRESULT asioCreateInstance(REFIID riid, LPVOID *ppobj)
+/* The largest latency range of a set of ports */
+static void ports_latency(Channel *c, int count, jack_latency_callback_mode_t mode, jack_latency_range_t *most)
 {
-    IWineASIOImpl * pobj;
-    TRACE("(%s, %p)\n", debugstr_guid(riid), ppobj);
+    jack_latency_range_t range;
+    int i;
 
-    pobj = HeapAlloc(GetProcessHeap(), 0, sizeof(*pobj));
-    if (pobj == NULL) {
-        WARN("out of memory\n");
-        return E_OUTOFMEMORY;
+    most->min = most->max = 0;
+    for (i = 0; i < count; i++)
+    {
+        jack_port_get_latency_range(c[i].port, mode, &range);
+        if (range.min > most->min)
+            most->min = range.min;
+        if (range.max > most->max)
+            most->max = range.max;
     }
+}
 
-    pobj->lpVtbl = &WineASIO_Vtbl;
-    pobj->ref = 1;
-    TRACE("pobj = %p\n", pobj);
-    *ppobj = pobj;
-    TRACE("return %p\n", *ppobj);
-    return S_OK;
+/* Runs in one of JACK's threads whenever latencies in the graph change.
+ * Keeps what the ports are connected to for getLatencies, and sets our
+ * ports' own ranges, which go through the host: a capture reaches our
+ * outputs the driver's input and output buffering later, and the same
+ * goes for playback back to our inputs.
+ */
+static void jack_latency(jack_latency_callback_mode_t mode, void * arg)
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
+    jack_latency_range_t range;
+    long input, output;
+    int i;
+
+    own_latencies(This, &input, &output);
+    if (mode == JackCaptureLatency)
+    {
+        ports_latency(This->input, This->num_inputs, mode, &range);
+        This->capture_latency = range.max;
+        range.min += input + output;
+        range.max += input + output;
+        for (i = 0; i < This->num_outputs; i++)
+            jack_port_set_latency_range(This->output[i].port, mode, &range);
+    }
+    else
+    {
+        ports_latency(This->output, This->num_outputs, mode, &range);
+        This->playback_latency = range.max;
+        range.min += input + output;
+        range.max += input + output;
+        for (i = 0; i < This->num_inputs; i++)
+            jack_port_set_latency_range(This->input[i].port, mode, &range);
+    }
+
+    This->latency_pending = 1;
+    sem_post(&This->notify_sem);
 }
 
-static void getNanoSeconds(ASIOTimeStamp* ts)
+/* Publish where this cycle falls in time, before its input is queued
+ * for the host.  jack_get_cycle_times has JACK's DLL filtered estimate;
+ * older JACKs only have the time of the cycle's first frame.
+ */
+static void publish_cycle(IWineASIOImpl *This, jack_nframes_t nframes)
 {
-    double nanoSeconds = (double)((unsigned long)timeGetTime ()) * 1000000.;
-    ts->hi = (unsigned long)(nanoSeconds / twoRaisedTo32);
-    ts->lo = (unsigned long)(nanoSeconds - (ts->hi * twoRaisedTo32));
+    Cycle cycle;
+    jack_nframes_t frames;
+    jack_time_t usecs, next;
+    jack_position_t transport;
+
+    cycle.stream = This->stream_frames;
+    cycle.frames = nframes;
+    if (jack_get_cycle_times(This->client, &frames, &usecs, &next, &cycle.period_usecs) != 0)
+    {
+        frames = jack_last_frame_time(This->client);
+        usecs = jack_frames_to_time(This->client, frames);
+        cycle.period_usecs = nframes * 1000000.0f / This->sample_rate;
+    }
+    cycle.usecs = usecs;
+    stage(This, STAGE_WAKE, ((long long)jack_get_time() - (long long)usecs) * 1000);
+
+    /* read, not counted: after an xrun the position has moved on as far as JACK has */
+    This->frame_clock = timing_advance(This->frame_clock, &This->cycle_frame, frames, !This->stream_frames);
+    cycle.frame = This->frame_clock;
+    This->record->frame = cycle.frame;
+
+    /* once a cycle for every host block in it, and nobody else has to ask JACK */
+    cycle.rolling = jack_transport_query(This->client, &transport) == JackTransportRolling;
+    cycle.transport = transport.frame;
+    timing_publish(&This->timing, &cycle);
+    This->stream_frames += nframes;
 }
 
-static int jack_process(jack_nframes_t nframes, void * arg)
+static void silence_outputs(IWineASIOImpl *This, jack_nframes_t nframes)
+{
+    int i;
+
+    for (i = 0; i < This->active_outputs; i++)
+        memset(jack_port_get_buffer(This->output[i].port, nframes), 0, nframes * sizeof(float));
+}
+
+static int process_cycle(IWineASIOImpl *This, jack_nframes_t nframes)
 {
-    IWineASIOImpl * This = (IWineASIOImpl*)arg;
     int i;
     char *in, *out;
+    long long start, t;
 //  jack_transport_state_t ts;
 //  jack_position_t transport;
 
 // ASIOSTInt32LSB support only
     //int *buffer;
 
-    if (This->state != Run)
-        return 0;
+    start = stats_now();
+    PROBE2(cycle_start, This->stats->client, nframes);
 
 //  ts = jack_transport_query(This->client, &transport);
 //  if (ts == JackTransportRolling)
@@ -1307,37 +2903,206 @@ static int jack_process(jack_nframes_t nframes, void * arg)
         if (This->client_state == Init)
             This->client_state = Run;
 
-        This->sample_position += nframes; //= transport.frame;
+        if (This->rt_memory)
+            mem_faults_count(&This->jack_faults);
+        This->stats->cycles++;
+        record_cycle(This, nframes, start);
 
-        /* get the input data from JACK and copy it to the ASIO buffers */
-        for (i = 0; i < This->active_inputs; i++)
+        /* Rings for a new period are ready: swap them in here, between
+         * cycles.  Decoupled, the win32 thread may be in the rings, so it
+         * swaps them the next time it is woken, and until then we keep out.
+         */
+        if (This->swap_frames)
+        {
+            if (!This->pipeline && claim_swap(This))
+                swap_rings(This);
+            else
+            {
+                silence_outputs(This, nframes);
+                if (This->pipeline)
+                {
+                    This->posted_ns = stats_now();
+                    handoff_post(&This->wake_win32);
+                }
+                return 0;
+            }
+        }
+
+        /* the rings were made for another period; play silence until there are new ones */
+        if ((long)nframes != This->jack_frames)
+        {
+            silence_outputs(This, nframes);
+            return 0;
+        }
+
+        publish_cycle(This, nframes);
+        t = stats_now();
+
+        if (This->direct && nframes == This->block_frames)
+        {
+            /* In direct mode the conversions happen here, straight between the
+             * JACK port buffers (which stay valid while we wait) and the ASIO
+             * half-buffers, so the WIN32 thread only has the callback to do
+             * between being woken and waking us.
+             */
+            const Converter *conv = &converters[This->in_buffer_format];
+            unsigned int *dither = This->dither ? This->dither_state : NULL;
+
+            for (i = 0; i < This->active_inputs; i++)
+            {
+                if (This->input[i].active == ASIOTrue) {
+                    in = jack_port_get_buffer(This->input[i].port, nframes);
+                    conv->from_float(&This->input[i].buffer[nframes * This->toggle * conv->size],
+                        gain_input(This, i, (const float *)in, nframes), nframes, dither);
+                }
+            }
+            lap(This, STAGE_INPUT, t);
+
+            run_callback(This);
+            if (jack_frames_since_cycle_start(This->client) > nframes)
+                note_late(This);
+            t = stats_now();
+
+            conv = &converters[This->out_buffer_format];
+            for (i = 0; i < This->num_outputs; i++)
+            {
+                if (This->output[i].active == ASIOTrue) {
+                    out = jack_port_get_buffer(This->output[i].port, nframes);
+                    conv->to_float((float *)out, &This->output[i].buffer[nframes * This->toggle * conv->size], nframes);
+                }
+            }
+            end_cycle(This, nframes, start, t);
+
+            This->toggle = This->toggle ? 0 : 1;
+            return 0;
+        }
+
+        if (This->pipeline)
         {
-            if (This->input[i].active == ASIOTrue) {
+            /* Decoupled: queue the input for the WIN32 thread and play output
+             * it queued earlier, without ever waiting for it.  If it has
+             * fallen behind, play silence for what is missing, then drop
+             * whatever would stretch the pipeline once it catches up.
+             */
+            size_t bytes = nframes * sizeof(float);
+            size_t most = (This->pipeline + 1) * bytes;     /* more queued than this is a late host catching up */
+            int tune = 0;
+            BOOL dropout = FALSE;
+
+            /* with a bigger host buffer, all but a period of a block is queued as well */
+            if (This->block_frames > (long)nframes)
+                most += (This->block_frames - nframes) * sizeof(float);
+
+            /* late: the host has not even taken the block it needed to be on time with this cycle's output */
+            if (This->live_now->pipeline_auto)
+                tune = tune_pipeline(This, nframes,
+                    This->pipeline_frames >= This->block_frames + (This->pipeline - 1) * (long)nframes);
+            else
+                tune = follow_pipeline(This, This->live_now->pipeline);
+
+            /* a host stalled for as long as the rings hold: drop this cycle's
+             * input whole, and count only what was queued
+             */
+            PROBE2(ring_write, This->stats->client, nframes);
+            if (rings_room(This->input, This->active_inputs) < bytes)
+                dropout = TRUE;
+            else
+            {
+                for (i = 0; i < This->active_inputs; i++)
+                {
+                    in = jack_port_get_buffer(This->input[i].port, nframes);
+                    jack_ringbuffer_write(This->input[i].ring, (const char *)gain_input(This, i, (const float *)in, nframes), bytes);
+                }
+                __sync_fetch_and_add(&This->pipeline_frames, nframes);
+            }
+            PROBE2(ring_write_done, This->stats->client, nframes);
+            t = lap(This, STAGE_INPUT, t);
+
+            if (__sync_lock_test_and_set(&This->output_dropped, 0))
+                dropout = TRUE;
+            This->posted_ns = t;
+            handoff_post(&This->wake_win32);
+
+            PROBE2(ring_read, This->stats->client, nframes);
+            for (i = 0; i < This->active_outputs; i++)
+            {
+                size_t got, queued = jack_ringbuffer_read_space(This->output[i].ring);
+
+                /* only whole samples are ever written, but never advance by part of one */
+                queued -= queued % sizeof(float);
+                out = jack_port_get_buffer(This->output[i].port, nframes);
+                if (tune > 0)
+                {
+                    memset(out, 0, bytes);
+                    continue;
+                }
 
-                //buffer = &This->input[i].buffer[This->block_frames * This->toggle];
-                in = jack_port_get_buffer(This->input[i].port, nframes);
+                if (tune < 0)
+                    jack_ringbuffer_read_advance(This->output[i].ring, queued < bytes ? queued : bytes);
+                else if (queued > most)
+                    jack_ringbuffer_read_advance(This->output[i].ring, queued - (most - bytes));
 
-                jack_ringbuffer_write(This->input[i].ring, in, nframes * sizeof(float));
+                got = jack_ringbuffer_read(This->output[i].ring, out, bytes);
+                if (got < bytes)
+                {
+                    memset(out + got, 0, bytes - got);
+                    dropout = TRUE;
+                }
             }
+            PROBE2(ring_read_done, This->stats->client, nframes);
+            if (dropout)
+                note_late(This);
+            end_cycle(This, nframes, start, t);
+            return 0;
         }
 
-        /* wake up the WIN32 thread so it can do its callback */
-        sem_post(&This->semaphore1);
+        /* get the input data from JACK and copy it to the ASIO buffers */
+        PROBE2(ring_write, This->stats->client, nframes);
+        if (rings_room(This->input, This->active_inputs) < nframes * sizeof(float))
+            note_late(This);
+        else
+        {
+            for (i = 0; i < This->active_inputs; i++)
+            {
+                if (This->input[i].active == ASIOTrue) {
+
+                    //buffer = &This->input[i].buffer[This->block_frames * This->toggle];
+                    in = jack_port_get_buffer(This->input[i].port, nframes);
+
+                    jack_ringbuffer_write(This->input[i].ring, (const char *)gain_input(This, i, (const float *)in, nframes), nframes * sizeof(float));
+                }
+            }
+            __sync_fetch_and_add(&This->pipeline_frames, nframes);
+        }
 
-        /* wait for the WIN32 thread to complete before continuing */
-        sem_wait(&This->semaphore2);
+        /* get the ASIO callback done, usually by the WIN32 thread, once a whole host block is in */
+        PROBE2(ring_write_done, This->stats->client, nframes);
+        t = lap(This, STAGE_INPUT, t);
+        if (This->pipeline_frames >= This->block_frames)
+        {
+            run_callback(This);
+            if (jack_frames_since_cycle_start(This->client) > nframes)
+                note_late(This);
+            t = stats_now();
+        }
 
         /* copy the ASIO data to JACK */
+        PROBE2(ring_read, This->stats->client, nframes);
         for (i = 0; i < This->num_outputs; i++)
         {
             if (This->output[i].active == ASIOTrue) {
+                size_t got, bytes = nframes * sizeof(float);
 
                 //buffer = &This->output[i].buffer[This->block_frames * (This->toggle)];
                 out = jack_port_get_buffer(This->output[i].port, nframes);
 
-                jack_ringbuffer_read(This->output[i].ring, out, nframes * sizeof(float));
+                got = jack_ringbuffer_read(This->output[i].ring, out, bytes);
+                if (got < bytes)
+                    memset(out + got, 0, bytes - got);
             }
         }
+        PROBE2(ring_read_done, This->stats->client, nframes);
+        end_cycle(This, nframes, start, t);
 
 //      This->toggle = This->toggle ? 0 : 1;
 
@@ -1347,6 +3112,19 @@ static int jack_process(jack_nframes_t nframes, void * arg)
     return 0;
 }
 
+/* a cycle, with one version of the live settings all through it */
+static int jack_process(jack_nframes_t nframes, void * arg)
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
+
+    if (This->state != Run)
+        return 0;
+    This->live_now = snapshot_read(&This->live);
+    process_cycle(This, nframes);
+    snapshot_done(&This->live);
+    return 0;
+}
+
 /*
  * The ASIO callback can make WIN32 calls which require a WIN32 thread.
  * Do the callback in this thread and then switch back to the Jack callback thread.
@@ -1373,6 +3151,9 @@ static DWORD CALLBACK win32_callback(LPVOID arg)
     setThreadToPriority(pthread_self(),96,TRUE,10000000);
 #endif
 
+    if (This->rt_memory && !mem_prefault_stack(This->stack_prefault * 1024))
+        TRACE("couldn't lock the win32 callback stack\n");
+
     /* let IWineASIO_Init know we are alive */
     SetEvent(This->start_event);
     TRACE("Win32 thread running...\n");
@@ -1380,7 +3161,7 @@ static DWORD CALLBACK win32_callback(LPVOID arg)
     while (1)
     {
         /* wait to be woken up by the JACK callback thread */
-        sem_wait(&This->semaphore1);
+        handoff_wait(&This->wake_win32);
 
         /* check for termination */
         if (This->terminate)
@@ -1389,54 +3170,189 @@ static DWORD CALLBACK win32_callback(LPVOID arg)
             TRACE("Win32 thread terminated\n");
             return 0;
         }
-        getNanoSeconds(&This->system_time);
 
         /* make sure we are in the run state */
         if (This->state == Run)
         {
-            int i;
-
-            This->sample_position += This->block_frames;
-
-            for (i = 0; i < This->active_inputs; i++) {
-                if (This->input[i].active == ASIOTrue) {
-                    int j, *buffer = &This->input[i].buffer[This->block_frames * This->toggle];
+            lap(This, STAGE_HANDOFF, This->posted_ns);
+            if (This->rt_memory)
+                mem_faults_count(&This->win32_faults);
 
-                    jack_ringbuffer_read(This->input[i].ring, (char*)This->tempbuf, This->block_frames * sizeof(float));
+            /* decoupled, nobody waits for us: do every whole block that has come in */
+            if (This->pipeline)
+            {
+                if (This->swap_frames && claim_swap(This))
+                    swap_rings(This);
 
-                    for (j = 0; j < This->block_frames; j++) buffer[j] = (int)(This->tempbuf[j] * (float)(0x7fffffff));
+                if (This->latency_changed)
+                {
+                    This->latency_changed = FALSE;
+                    update_latencies(This);
+                    TRACE("(%p) pipeline now %d periods, output latency %ld\n", This, This->pipeline, This->output_latency);
+                    tell_host(This, kAsioLatenciesChanged, 0);
                 }
+
+                process_blocks(This);
+                continue;
             }
 
-            if (This->time_info_mode)
+            /* in direct mode the JACK thread converts the output and flips the toggle */
+            This->output_posted = FALSE;
+            if (This->direct)
+                buffer_switch(This);
+            else
+                process_blocks(This);
+
+            /* let the JACK thread know we are done, unless outputReady already has */
+            if (!This->output_posted)
             {
-                __wrapped_IWineASIOImpl_getSamplePosition((LPWINEASIO)This,
-                    &This->asio_time.timeInfo.samplePosition, &This->asio_time.timeInfo.systemTime);
-                if (This->tc_read)
-                {
-                    This->asio_time.timeCode.timeCodeSamples.lo = This->asio_time.timeInfo.samplePosition.lo;
-                    This->asio_time.timeCode.timeCodeSamples.hi = 0;
-                }
-                This->callbacks->bufferSwitchTimeInfo(&This->asio_time, This->toggle, ASIOTrue);
-                This->asio_time.timeInfo.flags &= ~(kSampleRateChanged | kClockSourceChanged);
+                This->returned_ns = stats_now();
+                handoff_post(&This->wake_jack);
             }
-            else
-                This->callbacks->bufferSwitch(This->toggle, ASIOTrue);
+        }
+    }
 
-            /* let the JACK thread know we are done */
-            sem_post(&This->semaphore2);
+    return 0;
+}
 
-            for (i = 0; i < This->num_outputs; i++) {
-                if (This->output[i].active == ASIOTrue) {
-                    int j, *buffer = &This->output[i].buffer[This->block_frames * This->toggle];
-                    
-                    for (j = 0; j < This->block_frames; j++) This->tempbuf[j] = ((float)(buffer[j]) / (float)(0x7fffffff));
-                    
-                    jack_ringbuffer_write(This->output[i].ring, (char*)This->tempbuf, This->block_frames * sizeof(float));
-                }
-            }
+/* how long the notification thread gives the audio threads to swap rings */
+#define SWAP_WAIT 1000  /* ms */
 
-            This->toggle = This->toggle ? 0 : 1;
+/* Off the RT threads: JACK's period has changed under the host's buffers.
+ * If they reblock to the new one, make rings for it and have the audio
+ * threads swap them in, and the host only needs to know the latencies
+ * have changed.  If they don't, or in exclusive mode, where the host is
+ * meant to set the period, ask it to change its buffer size
+ * (kAsioBufferSizeChange), or failing that to reset.
+ */
+static void change_period(IWineASIOImpl *This, long frames)
+{
+    ASIOCallbacks *callbacks;
+    BOOL live = FALSE;
+    int i;
+
+    EnterCriticalSection(&This->reconfig);
+    callbacks = This->callbacks;
+    if (!callbacks || frames == This->jack_frames)
+    {
+        /* no buffers, the host will see the period when it makes them */
+        LeaveCriticalSection(&This->reconfig);
+        return;
+    }
+
+    TRACE("(%p) JACK's period changed from %ld to %ld frames\n", This, This->jack_frames, frames);
+    if (can_reblock(This->block_frames, frames))
+    {
+        arena_destroy(&This->old_rings.arena);
+        if (make_rings(This, &This->next_rings, frames))
+        {
+            __sync_synchronize();
+            This->swap_frames = frames;
+            for (i = 0; i < SWAP_WAIT && This->swap_frames && This->state == Run; i++)
+                Sleep(1);
+            /* stopped, or JACK has stalled: nobody is in the rings to mind */
+            if (claim_swap(This))
+                swap_rings(This);
+            live = TRUE;
+            TRACE("(%p) now reblocking %ld frames to %ld\n", This, This->block_frames, frames);
+        }
+        else
+            WARN("(%p) no memory for rings at the new period\n", This);
+    }
+    LeaveCriticalSection(&This->reconfig);
+
+    if (live && !This->exclusive)
+    {
+        tell_host(This, kAsioLatenciesChanged, 0);
+        return;
+    }
+
+    if (!tell_host(This, kAsioBufferSizeChange, frames) && !tell_host(This, kAsioResetRequest, 0))
+        WARN("(%p) the host can't be asked to remake its buffers, restart it\n", This);
+}
+
+/* nothing of ours depends on the rate, but the host's time info does */
+static void change_rate(IWineASIOImpl *This, long rate)
+{
+    ASIOCallbacks *callbacks = This->callbacks;
+
+    TRACE("(%p) JACK's sample rate changed from %f to %ld\n", This, This->sample_rate, rate);
+    This->sample_rate = rate;
+    This->miliseconds = (long)((double)(This->block_frames * 1000) / This->sample_rate);
+    This->asio_time.timeInfo.sampleRate = This->sample_rate;
+    This->asio_time.timeInfo.flags |= kSampleRateChanged;
+
+    if (callbacks && callbacks->sampleRateDidChange)
+        callbacks->sampleRateDidChange(This->sample_rate);
+}
+
+/* jack_latency has new numbers from the graph; the host only hears of
+ * them if that changes what getLatencies says
+ */
+static void change_latency(IWineASIOImpl *This)
+{
+    long input = This->input_latency, output = This->output_latency;
+
+    update_latencies(This);
+    if (This->input_latency == input && This->output_latency == output)
+        return;
+
+    TRACE("(%p) latencies now %ld in, %ld out, of which JACK %ld and %ld\n", This,
+        This->input_latency, This->output_latency, This->capture_latency, This->playback_latency);
+    tell_host(This, kAsioLatenciesChanged, 0);
+}
+
+/* What led up to a dropout, from the flight recorder.  A burst of them
+ * gets one dump, until the cycles it covered have gone by.
+ */
+static void dump_cycles(IWineASIOImpl *This, const char *why)
+{
+    unsigned long long cycle = This->dropout_cycle;
+
+    if (This->dumped_cycle && cycle < This->dumped_cycle + RECORDER_DUMP)
+        return;
+    This->dumped_cycle = cycle;
+    recorder_dump(This->recorder, cycle, This->stats->client, why);
+    TRACE("(%p) %s in cycle %llu, the cycles before it are in /tmp/wineasio-%s.flight\n",
+        This, why, cycle, This->stats->client);
+}
+
+/*
+ * Period and sample rate changes, latencies and dropouts are seen to
+ * here: hosts may be told from any thread, but it has to be a WIN32 one,
+ * and the audio threads may not be running to lend theirs.
+ */
+static DWORD CALLBACK win32_notify(LPVOID arg)
+{
+    IWineASIOImpl * This = (IWineASIOImpl*)arg;
+    long changed;
+
+    while (1)
+    {
+        if (sem_wait(&This->notify_sem) && errno == EINTR)
+            continue;
+
+        if (This->terminate)
+            return 0;
+
+        if ((changed = __sync_lock_test_and_set(&This->rate_changed, 0)))
+            change_rate(This, changed);
+        if ((changed = __sync_lock_test_and_set(&This->period_changed, 0)))
+            change_period(This, changed);
+
+        if (__sync_lock_test_and_set(&This->latency_pending, 0))
+            change_latency(This);
+
+        /* the host may want to resync its timeline, or raise its buffer size */
+        if (__sync_lock_test_and_set(&This->xrun_pending, 0))
+        {
+            dump_cycles(This, "xrun");
+            tell_host(This, kAsioResyncRequest, 0);
+        }
+        if (__sync_lock_test_and_set(&This->late_pending, 0))
+        {
+            dump_cycles(This, "late");
+            tell_host(This, kAsioOverload, 0);
         }
     }
 
@@ -0,0 +1,157 @@
+/*
+ * A Unix socket for each client, to ask the running driver how it is
+ * doing and change some of its settings
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+/* a line at a time, until the other end goes or we close */
+static void control_serve(Control *control, int fd)
+{
+    FILE *in = fdopen(fd, "r"), *out;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t got;
+    int wfd;
+
+    if (!in)
+    {
+        close(fd);
+        return;
+    }
+    if ((wfd = dup(fd)) < 0 || !(out = fdopen(wfd, "w")))
+    {
+        if (wfd >= 0)
+            close(wfd);
+        fclose(in);
+        return;
+    }
+
+    while (!control->closing && (got = getline(&line, &len, in)) != -1)
+    {
+        while (got > 0 && (line[got - 1] == '\n' || line[got - 1] == '\r'))
+            line[--got] = '\0';
+        if (got == 0)
+            continue;
+        control->command(control->arg, line, out);
+        if (fflush(out) != 0)
+            break;
+    }
+    free(line);
+    fclose(out);
+    fclose(in);
+}
+
+static void *control_thread(void *arg)
+{
+    Control *control = arg;
+    int fd;
+
+    while (!control->closing)
+    {
+        if ((fd = accept(control->listener, NULL, NULL)) < 0)
+        {
+            if (!control->closing)
+                usleep(100000);     /* out of descriptors, say */
+            continue;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        control->connection = fd;
+        __sync_synchronize();
+        if (!control->closing)
+            control_serve(control, fd);
+        else
+            close(fd);
+        control->connection = -1;
+    }
+    return NULL;
+}
+
+Control *control_open(const char *client, control_func command, void *arg)
+{
+    Control *control;
+    struct sockaddr_un addr;
+    char *p;
+
+    if (!(control = calloc(1, sizeof(Control))))
+        return NULL;
+    snprintf(control->path, sizeof(control->path), "/tmp/wineasio-%.*s.sock",
+        (int)(sizeof(control->path) - sizeof("/tmp/wineasio-.sock")), client);
+    for (p = control->path + sizeof("/tmp/") - 1; *p; p++)
+        if (*p == '/')
+            *p = '_';
+    control->connection = -1;
+    control->command = command;
+    control->arg = arg;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, control->path, sizeof(control->path));
+
+    /* one left behind by a client of this name that didn't close */
+    unlink(control->path);
+    if ((control->listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        free(control);
+        return NULL;
+    }
+    /* bind makes the socket anew, so it can't be sent down someone's symlink */
+    if (fcntl(control->listener, F_SETFD, FD_CLOEXEC) != 0
+        || bind(control->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || chmod(control->path, 0600) != 0
+        || listen(control->listener, 4) != 0
+        || pthread_create(&control->thread, NULL, control_thread, control) != 0)
+    {
+        close(control->listener);
+        unlink(control->path);
+        free(control);
+        return NULL;
+    }
+    return control;
+}
+
+void control_close(Control *control)
+{
+    int fd;
+
+    if (!control)
+        return;
+    control->closing = 1;
+    __sync_synchronize();
+
+    /* wakes accept, and getline on a connection */
+    shutdown(control->listener, SHUT_RDWR);
+    if ((fd = control->connection) >= 0)
+        shutdown(fd, SHUT_RDWR);
+    pthread_join(control->thread, NULL);
+
+    close(control->listener);
+    unlink(control->path);
+    free(control);
+}
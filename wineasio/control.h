@@ -0,0 +1,50 @@
+/*
+ * A Unix socket for each client, to ask the running driver how it is
+ * doing and change some of its settings
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_CONTROL_H
+#define __WINEASIO_CONTROL_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* /tmp/wineasio-<JACK client name>.sock, with any '/' in the name made '_' */
+#define CONTROL_PATH    108     /* sun_path */
+
+/* One command line, without its newline.  Whatever it prints is the
+ * reply; it ends with a line "ok", or "error: " and why.
+ */
+typedef void (*control_func)(void *arg, char *line, FILE *reply);
+
+typedef struct _Control {
+    char                path[CONTROL_PATH];
+    int                 listener;
+    volatile int        connection;     /* -1 between them */
+    volatile int        closing;
+    pthread_t           thread;
+    control_func        command;
+    void                *arg;
+} Control;
+
+/* Listen, and serve one connection at a time from a thread of its own,
+ * never a realtime one.  NULL if the socket can't be made.
+ */
+extern Control *control_open(const char *client, control_func command, void *arg);
+extern void control_close(Control *control);
+
+#endif /* __WINEASIO_CONTROL_H */
@@ -0,0 +1,158 @@
+/*
+ * Waking the other audio thread once per cycle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "handoff.h"
+#include "probes.h"
+
+/* check the clock every this many spins */
+#define SPIN_CHECK  64
+
+#ifdef __linux__
+static void futex_wait(volatile int *addr, int expect)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expect, NULL, NULL, 0);
+}
+
+static void futex_wake(volatile int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+/* never called, handoff_init keeps everyone else on the semaphore */
+static void futex_wait(volatile int *addr, int expect) { (void)addr; (void)expect; }
+static void futex_wake(volatile int *addr) { (void)addr; }
+#endif
+
+static inline void cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+/* ns since start, saturating well below LONG_MAX on 32 bit */
+static long elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - start->tv_sec > 1)
+        return 1000000000L;
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+void handoff_init(Handoff *handoff, int futex, long spin_max)
+{
+#ifdef __linux__
+    handoff->futex = futex;
+#else
+    (void)futex;
+    handoff->futex = 0;
+#endif
+    sem_init(&handoff->sem, 0, 0);
+    handoff->seq = 0;
+    handoff->seen = 0;
+    handoff->sleeping = 0;
+    handoff->spin_max = spin_max;
+    handoff->spin = spin_max;
+    handoff->wait_avg = 0;
+}
+
+void handoff_destroy(Handoff *handoff)
+{
+    sem_destroy(&handoff->sem);
+}
+
+void handoff_post(Handoff *handoff)
+{
+    PROBE1(handoff_post, handoff);
+    if (!handoff->futex)
+    {
+        sem_post(&handoff->sem);
+        return;
+    }
+
+    /* a full barrier, so either we see the waiter asleep or it sees the new seq */
+    __sync_fetch_and_add(&handoff->seq, 1);
+    if (handoff->sleeping)
+        futex_wake(&handoff->seq);
+}
+
+void handoff_wait(Handoff *handoff)
+{
+    struct timespec start;
+    int expect = handoff->seen;
+    long spins, waited = 0;
+
+    PROBE1(handoff_wait, handoff);
+    if (!handoff->futex)
+    {
+        sem_wait(&handoff->sem);
+        PROBE1(handoff_woken, handoff);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (spins = 1; handoff->seq == expect && handoff->spin > 0; spins++)
+    {
+        if (spins % SPIN_CHECK == 0 && elapsed(&start) >= handoff->spin)
+            break;
+        cpu_relax();
+    }
+
+    if (handoff->seq == expect)
+    {
+        handoff->sleeping = 1;
+        __sync_synchronize();
+        while (handoff->seq == expect)
+            futex_wait(&handoff->seq, expect);
+        handoff->sleeping = 0;
+    }
+
+    handoff->seen = expect + 1;
+    PROBE1(handoff_woken, handoff);
+
+    /* spin for half as long again as waits usually take, unless that is too long to be worth it */
+    waited = elapsed(&start);
+    handoff->wait_avg += (waited - handoff->wait_avg) / 8;
+    handoff->spin = handoff->wait_avg + handoff->wait_avg / 2;
+    if (handoff->spin > handoff->spin_max)
+        handoff->spin = 0;
+}
+
+int handoff_pending(Handoff *handoff)
+{
+    int value = 0;
+
+    if (!handoff->futex)
+        sem_getvalue(&handoff->sem, &value);
+    else
+        value = handoff->seq - handoff->seen;
+    return value;
+}
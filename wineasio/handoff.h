@@ -0,0 +1,50 @@
+/*
+ * Waking the other audio thread once per cycle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_HANDOFF_H
+#define __WINEASIO_HANDOFF_H
+
+#include <semaphore.h>
+
+/* A one-way wakeup with semaphore semantics.  In futex mode the waiter
+ * spins on the sequence word for a while before sleeping on it, and the
+ * poster only makes a system call when the waiter is asleep.  How long
+ * to spin follows the waits seen so far: waits longer than spin_max are
+ * slept through from the start.
+ */
+typedef struct _Handoff {
+    int             futex;      /* else a plain semaphore */
+    sem_t           sem;
+    volatile int    seq;        /* posts so far, the futex word */
+    int             seen;       /* posts consumed by the waiter */
+    volatile int    sleeping;   /* the waiter is in FUTEX_WAIT */
+    long            spin_max;   /* ns */
+    long            spin;       /* ns, what the next wait will spin for */
+    long            wait_avg;   /* ns */
+} Handoff;
+
+extern void handoff_init(Handoff *handoff, int futex, long spin_max);
+extern void handoff_destroy(Handoff *handoff);
+
+extern void handoff_post(Handoff *handoff);
+extern void handoff_wait(Handoff *handoff);
+
+/* posts not yet waited for, as far as anyone but the waiter can tell */
+extern int handoff_pending(Handoff *handoff);
+
+#endif /* __WINEASIO_HANDOFF_H */
@@ -0,0 +1,291 @@
+/*
+ * The driver's control panel: a Win32 window showing how the cycles are
+ * going, with the settings that can change without new buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <wine/windows/windef.h>
+#include <wine/windows/winbase.h>
+#include <wine/windows/wingdi.h>
+#include <wine/windows/winuser.h>
+
+#include "panel.h"
+
+#define PANEL_CLASS     "WineASIOPanel"
+#define PANEL_REFRESH   500     /* ms */
+#define PANEL_TEXT      4096
+
+enum {
+    ID_TEXT = 100,
+    ID_PIPELINE,
+    ID_DITHER,
+    ID_TIMER = 1
+};
+
+static const char *stage_names[STAGES] = STAGE_NAMES;
+
+static void append(char *text, int *used, const char *format, ...)
+{
+    va_list args;
+    int n;
+
+    if (*used >= PANEL_TEXT - 1)
+        return;
+    va_start(args, format);
+    n = vsnprintf(text + *used, PANEL_TEXT - *used, format, args);
+    va_end(args);
+    if (n > 0)
+        *used += n;
+}
+
+/* The stages since the last refresh, and what the driver is doing now.
+ * The counters are read as they are, while the audio threads write them.
+ */
+static void panel_text(Panel *panel, const PanelState *state, char *text)
+{
+    unsigned int count[STATS_BUCKETS], total;
+    double period_ns = state->sample_rate > 0 ? state->period * 1e9 / state->sample_rate : 0;
+    double p50[STAGES], p99[STAGES];
+    unsigned int max[STAGES], longest;
+    const Histogram *h;
+    int used = 0, s, b;
+
+    for (s = 0; s < STAGES; s++)
+    {
+        h = &panel->stats->stage[s];
+        total = 0;
+        for (b = 0; b < STATS_BUCKETS; b++)
+        {
+            count[b] = h->count[b] - panel->last[s].count[b];
+            panel->last[s].count[b] = h->count[b];
+            total += count[b];
+        }
+
+        /* a new longest came since the last refresh; else the buckets bound this one's */
+        longest = h->max;
+        if (longest > panel->last[s].max)
+            max[s] = longest;
+        else
+            max[s] = (unsigned int)stats_longest(count, longest);
+        panel->last[s].max = longest;
+        p50[s] = total ? stats_quantile(count, total, 0.5, max[s]) : -1;
+        p99[s] = total ? stats_quantile(count, total, 0.99, max[s]) : -1;
+    }
+
+    append(text, &used, "%s\r\n", panel->stats->client);
+    append(text, &used, "%s", state->mode);
+    if (state->pipeline)
+        append(text, &used, ", %d period pipeline%s", state->pipeline, state->pipeline_auto ? " (auto)" : "");
+    append(text, &used, "\r\nJACK period %ld at %.0f Hz (%.2f ms), host buffer %ld\r\n",
+        state->period, state->sample_rate, period_ns / 1e6, state->buffer);
+    append(text, &used, "samples %s in, %s out, dither %s\r\n",
+        state->in_format, state->out_format, state->dither ? "on" : "off");
+    append(text, &used, "%llu cycles, %u xruns, %u late\r\n\r\n",
+        panel->stats->cycles, panel->stats->xruns, panel->stats->late);
+
+    append(text, &used, "%-10s %9s %9s %9s\r\n", "stage", "p50 us", "p99 us", "max us");
+    for (s = 0; s < STAGES; s++)
+    {
+        if (p50[s] < 0)
+            append(text, &used, "%-10s %9s\r\n", stage_names[s], "-");
+        else
+            append(text, &used, "%-10s %9.1f %9.1f %9.1f\r\n", stage_names[s],
+                p50[s] / 1000.0, p99[s] / 1000.0, max[s] / 1000.0);
+    }
+
+    /* how much of the period the host takes, and what waking each other costs */
+    if (p50[STAGE_CALLBACK] >= 0 && period_ns > 0)
+        append(text, &used, "\r\ncallback load %.0f%% p50, %.0f%% p99, %.0f%% max of the period\r\n",
+            100.0 * p50[STAGE_CALLBACK] / period_ns, 100.0 * p99[STAGE_CALLBACK] / period_ns,
+            100.0 * max[STAGE_CALLBACK] / period_ns);
+    if (p99[STAGE_HANDOFF] >= 0)
+        append(text, &used, "handoff wait %.1f us to the host, %.1f us back, p99\r\n",
+            p99[STAGE_HANDOFF] / 1000.0, p99[STAGE_RETURN] >= 0 ? p99[STAGE_RETURN] / 1000.0 : 0.0);
+}
+
+static void panel_refresh(Panel *panel, HWND window)
+{
+    char text[PANEL_TEXT];
+    PanelState state;
+    HWND pipeline = GetDlgItem(window, ID_PIPELINE);
+
+    text[0] = '\0';
+    panel->ops->state(panel->arg, &state);
+    panel_text(panel, &state, text);
+    SetWindowTextA(GetDlgItem(window, ID_TEXT), text);
+
+    /* the control socket may have changed them too; don't fight an open list */
+    EnableWindow(pipeline, state.pipeline != 0);
+    if (!SendMessageA(pipeline, CB_GETDROPPEDSTATE, 0, 0))
+        SendMessageA(pipeline, CB_SETCURSEL, !state.pipeline ? -1 : state.pipeline_auto ? 0 : state.pipeline, 0);
+    SendMessageA(GetDlgItem(window, ID_DITHER), BM_SETCHECK, state.dither ? BST_CHECKED : BST_UNCHECKED, 0);
+}
+
+static LRESULT CALLBACK panel_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam)
+{
+    Panel *panel = (Panel *)GetWindowLongPtrA(window, GWLP_USERDATA);
+    LRESULT sel;
+
+    switch (message)
+    {
+    case WM_TIMER:
+        if (panel)
+            panel_refresh(panel, window);
+        return 0;
+    case WM_COMMAND:
+        if (!panel)
+            break;
+        if (LOWORD(wparam) == ID_PIPELINE && HIWORD(wparam) == CBN_SELCHANGE
+            && (sel = SendMessageA((HWND)lparam, CB_GETCURSEL, 0, 0)) >= 0)
+            panel->ops->set_pipeline(panel->arg, (int)sel);
+        else if (LOWORD(wparam) == ID_DITHER && HIWORD(wparam) == BN_CLICKED)
+            panel->ops->set_dither(panel->arg,
+                SendMessageA((HWND)lparam, BM_GETCHECK, 0, 0) == BST_CHECKED);
+        return 0;
+    case WM_DESTROY:
+        KillTimer(window, ID_TIMER);
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProcA(window, message, wparam, lparam);
+}
+
+static HWND panel_create(Panel *panel)
+{
+    HINSTANCE instance = GetModuleHandleA(NULL);
+    HFONT fixed = GetStockObject(ANSI_FIXED_FONT), gui = GetStockObject(DEFAULT_GUI_FONT);
+    char title[64 + STATS_NAME];
+    WNDCLASSA wc;
+    HWND window, child;
+    static const char *depths[] = { "auto", "1", "2", "3", "4" };
+    int i;
+
+    memset(&wc, 0, sizeof(wc));
+    wc.lpfnWndProc = panel_proc;
+    wc.hInstance = instance;
+    wc.hCursor = LoadCursorA(NULL, IDC_ARROW);
+    wc.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+    wc.lpszClassName = PANEL_CLASS;
+    RegisterClassA(&wc);    /* fails harmlessly when already registered */
+
+    snprintf(title, sizeof(title), "WineASIO - %s", panel->stats->client);
+    window = CreateWindowA(PANEL_CLASS, title, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX,
+        CW_USEDEFAULT, CW_USEDEFAULT, 560, 420, NULL, NULL, instance, NULL);
+    if (!window)
+        return NULL;
+    SetWindowLongPtrA(window, GWLP_USERDATA, (LONG_PTR)panel);
+
+    child = CreateWindowA("STATIC", "", WS_CHILD | WS_VISIBLE | SS_LEFT,
+        10, 10, 530, 310, window, (HMENU)(UINT_PTR)ID_TEXT, instance, NULL);
+    SendMessageA(child, WM_SETFONT, (WPARAM)fixed, 0);
+
+    child = CreateWindowA("STATIC", "Pipeline:", WS_CHILD | WS_VISIBLE | SS_LEFT,
+        10, 338, 60, 20, window, NULL, instance, NULL);
+    SendMessageA(child, WM_SETFONT, (WPARAM)gui, 0);
+    child = CreateWindowA("COMBOBOX", "", WS_CHILD | WS_VISIBLE | WS_TABSTOP | CBS_DROPDOWNLIST,
+        75, 334, 80, 150, window, (HMENU)(UINT_PTR)ID_PIPELINE, instance, NULL);
+    SendMessageA(child, WM_SETFONT, (WPARAM)gui, 0);
+    for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+        SendMessageA(child, CB_ADDSTRING, 0, (LPARAM)depths[i]);
+
+    child = CreateWindowA("BUTTON", "Dither int16 and int24", WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_AUTOCHECKBOX,
+        180, 336, 200, 20, window, (HMENU)(UINT_PTR)ID_DITHER, instance, NULL);
+    SendMessageA(child, WM_SETFONT, (WPARAM)gui, 0);
+
+    panel_refresh(panel, window);
+    SetTimer(window, ID_TIMER, PANEL_REFRESH, NULL);
+    ShowWindow(window, SW_SHOWNORMAL);
+    UpdateWindow(window);
+    return window;
+}
+
+static DWORD CALLBACK panel_thread(LPVOID arg)
+{
+    Panel *panel = (Panel *)arg;
+    MSG msg;
+
+    panel->window = panel_create(panel);
+    SetEvent(panel->ready);
+    if (!panel->window)
+        return 0;
+
+    while (GetMessageA(&msg, NULL, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessageA(&msg);
+    }
+    panel->window = NULL;
+    return 0;
+}
+
+Panel *panel_open(Stats *stats, const PanelOps *ops, void *arg)
+{
+    Panel *panel = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(Panel));
+
+    if (!panel)
+        return NULL;
+    panel->stats = stats;
+    panel->ops = ops;
+    panel->arg = arg;
+
+    /* the window belongs to the thread that makes it, so it is made there */
+    panel->ready = CreateEventW(NULL, FALSE, FALSE, NULL);
+    panel->thread = CreateThread(NULL, 0, panel_thread, panel, 0, NULL);
+    if (!panel->thread)
+    {
+        CloseHandle(panel->ready);
+        HeapFree(GetProcessHeap(), 0, panel);
+        return NULL;
+    }
+    WaitForSingleObject(panel->ready, INFINITE);
+    CloseHandle(panel->ready);
+    if (!panel->window)
+    {
+        panel_close(panel);
+        return NULL;
+    }
+    return panel;
+}
+
+BOOL panel_raise(Panel *panel)
+{
+    HWND window = panel->window;
+
+    if (!window)
+        return FALSE;
+    ShowWindow(window, SW_SHOWNORMAL);
+    SetForegroundWindow(window);
+    return TRUE;
+}
+
+void panel_close(Panel *panel)
+{
+    HWND window;
+
+    if (!panel)
+        return;
+    if ((window = panel->window))
+        PostMessageA(window, WM_CLOSE, 0, 0);
+    WaitForSingleObject(panel->thread, INFINITE);
+    CloseHandle(panel->thread);
+    HeapFree(GetProcessHeap(), 0, panel);
+}
@@ -0,0 +1,66 @@
+/*
+ * The driver's control panel: a Win32 window showing how the cycles are
+ * going, with the settings that can change without new buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_PANEL_H
+#define __WINEASIO_PANEL_H
+
+#include <wine/windows/windef.h>
+
+#include "stats.h"
+
+/* what the driver is doing, asked for at every refresh */
+typedef struct _PanelState {
+    const char          *mode;
+    const char          *in_format;
+    const char          *out_format;
+    double              sample_rate;
+    long                period;         /* JACK's, frames */
+    long                buffer;         /* the host's */
+    int                 pipeline;       /* periods, 0 when coupled */
+    int                 pipeline_auto;
+    int                 dither;
+} PanelState;
+
+typedef struct _PanelOps {
+    void                (*state)(void *arg, PanelState *state);
+    void                (*set_pipeline)(void *arg, int depth);      /* 0 for auto; only while decoupled */
+    void                (*set_dither)(void *arg, int dither);
+} PanelOps;
+
+typedef struct _Panel {
+    HANDLE              thread;
+    HANDLE              ready;
+    volatile HWND       window;         /* NULL once closed */
+    Stats               *stats;
+    Histogram           last[STAGES];   /* as at the last refresh */
+    const PanelOps      *ops;
+    void                *arg;
+} Panel;
+
+/* The window, on a thread of its own so controlPanel returns at once.
+ * NULL if it can't be made.
+ */
+extern Panel *panel_open(Stats *stats, const PanelOps *ops, void *arg);
+
+/* bring it to the front; FALSE if it has been closed meanwhile */
+extern BOOL panel_raise(Panel *panel);
+
+extern void panel_close(Panel *panel);
+
+#endif /* __WINEASIO_PANEL_H */
@@ -0,0 +1,44 @@
+/*
+ * Static probes on the audio path, for perf and bpftrace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_PROBES_H
+#define __WINEASIO_PROBES_H
+
+/* USDT probes of provider wineasio: a single nop each in the code, and
+ * an ELF note perf and bpftrace find them by, so they cost nothing until
+ * something attaches.  The Makefile defines HAVE_SYS_SDT_H when systemtap's
+ * header is installed; without it they compile to nothing at all.
+ *
+ * cycle_start, cycle_end          (client, nframes)   jack_process
+ * handoff_post, handoff_wait,
+ * handoff_woken                   (handoff)           either audio thread
+ * callback_start, callback_end    (client, toggle)    the host's bufferSwitch
+ * ring_read, ring_read_done,
+ * ring_write, ring_write_done     (client, frames)    the rings, on both sides
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a)         DTRACE_PROBE1(wineasio, name, a)
+#define PROBE2(name, a, b)      DTRACE_PROBE2(wineasio, name, a, b)
+#else
+#define PROBE1(name, a)         do { } while (0)
+#define PROBE2(name, a, b)      do { } while (0)
+#endif
+
+#endif /* __WINEASIO_PROBES_H */
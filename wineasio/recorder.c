@@ -0,0 +1,117 @@
+/*
+ * A flight recorder of the last JACK cycles, dumped when one goes wrong
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+
+static const char *stage_names[STAGES] = STAGE_NAMES;
+
+Recorder *recorder_new(void)
+{
+    return calloc(1, sizeof(Recorder));
+}
+
+void recorder_free(Recorder *recorder)
+{
+    free(recorder);
+}
+
+Record *recorder_begin(Recorder *recorder, unsigned long long cycle)
+{
+    Record *r = &recorder->record[cycle & (RECORDER_CYCLES - 1)];
+
+    r->cycle = 0;
+    __sync_synchronize();
+    memset((char *)r + sizeof(r->cycle), 0, sizeof(Record) - sizeof(r->cycle));
+    __sync_synchronize();
+    r->cycle = cycle;
+    return r;
+}
+
+void recorder_dump(Recorder *recorder, unsigned long long cycle, const char *client, const char *why)
+{
+    Record *copy, *r;
+    char path[64 + 256], *p, stamp[32];
+    long long first = 0;
+    time_t now = time(NULL);
+    struct stat st;
+    FILE *f = NULL;
+    int fd, i, s;
+
+    if (!(copy = malloc(sizeof(recorder->record))))
+        return;
+    memcpy(copy, recorder->record, sizeof(recorder->record));
+
+    snprintf(path, sizeof(path), "/tmp/wineasio-%.200s.flight", client);
+    for (p = path + sizeof("/tmp/") - 1; *p; p++)
+        if (*p == '/')
+            *p = '_';
+    /* /tmp is everyone's: append only to a file of our own, not through a symlink */
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644)) >= 0)
+    {
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() && st.st_nlink == 1)
+            f = fdopen(fd, "a");
+        if (!f)
+            close(fd);
+    }
+    if (!f)
+    {
+        free(copy);
+        return;
+    }
+
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(f, "# %s %s: %s in cycle %llu\n", stamp, client, why, cycle);
+    fprintf(f, "# %10s %10s %12s %6s", "cycle", "start us", "frame", "frames");
+    for (s = 0; s < STAGES; s++)
+        fprintf(f, " %9s", stage_names[s]);
+    fprintf(f, " %3s %3s %5s %6s %6s %6s %6s %4s %4s\n",
+        "in", "out", "state", "client", "direct", "toggle", "queued", ">w32", ">jck");
+
+    for (i = RECORDER_DUMP - 1; i >= 0; i--)
+    {
+        if (cycle < (unsigned long long)i + 1)
+            continue;
+        r = &copy[(cycle - i) & (RECORDER_CYCLES - 1)];
+        if (r->cycle != cycle - i)
+            continue;           /* overwritten, or never written */
+        if (!first)
+            first = r->start;
+
+        fprintf(f, "%c %10llu %10.1f %12lld %6u", r->cycle == cycle ? '>' : ' ',
+            r->cycle, (r->start - first) / 1000.0, r->frame, r->nframes);
+        for (s = 0; s < STAGES; s++)
+            fprintf(f, " %9.1f", r->stage[s] / 1000.0);
+        fprintf(f, " %3d %3d %5d %6d %6d %6d %6ld %4d %4d\n",
+            r->inputs, r->outputs, r->state, r->client_state, r->direct, r->toggle,
+            r->queued, r->to_win32, r->to_jack);
+    }
+    fprintf(f, "\n");
+    fclose(f);
+    free(copy);
+}
@@ -0,0 +1,63 @@
+/*
+ * A flight recorder of the last JACK cycles, dumped when one goes wrong
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_RECORDER_H
+#define __WINEASIO_RECORDER_H
+
+#include "stats.h"
+
+#define RECORDER_CYCLES 256     /* kept, a power of two */
+#define RECORDER_DUMP   32      /* dumped, up to the one that went wrong */
+
+/* One JACK cycle.  The JACK thread starts it and fills in its side, the
+ * callback thread adds its stages.  Nothing waits for anything: a reader
+ * may find the latest record half written.
+ */
+typedef struct _Record {
+    unsigned long long  cycle;          /* Stats' count; 0 while being cleared */
+    long long           start;          /* ns, CLOCK_MONOTONIC, when jack_process was entered */
+    long long           frame;          /* JACK's frame time, from start */
+    unsigned int        nframes;
+    int                 stage[STAGES];  /* ns */
+    short               inputs;         /* active channels */
+    short               outputs;
+    char                state;          /* the driver's, and the JACK thread's */
+    char                client_state;
+    char                direct;
+    char                toggle;
+    long                queued;         /* input waiting for the host, ring modes */
+    int                 to_win32;       /* wakeups posted and not yet taken */
+    int                 to_jack;
+} Record;
+
+typedef struct _Recorder {
+    Record              record[RECORDER_CYCLES];
+} Recorder;
+
+extern Recorder *recorder_new(void);
+extern void recorder_free(Recorder *recorder);
+
+/* the record for a new cycle, cleared; JACK thread only */
+extern Record *recorder_begin(Recorder *recorder, unsigned long long cycle);
+
+/* Append the RECORDER_DUMP cycles up to cycle to /tmp/wineasio-<client>.flight.
+ * Does file I/O, so never from the audio threads.
+ */
+extern void recorder_dump(Recorder *recorder, unsigned long long cycle, const char *client, const char *why);
+
+#endif /* __WINEASIO_RECORDER_H */
@@ -23,11 +23,42 @@ static const char* ENVVAR_OUTPORTNAMEPREFIX = "OUTPORTNAME";
 static const char* ENVVAR_INMAP = "_INPORT";
 static const char* ENVVAR_OUTMAP = "_OUTPORT";
 static const char* ENVVAR_AUTOCONNECT = "_AUTOCONNECT";
+static const char* ENVVAR_SAMPLETYPE = "_SAMPLETYPE";
+static const char* ENVVAR_INSAMPLETYPE = "_INSAMPLETYPE";
+static const char* ENVVAR_OUTSAMPLETYPE = "_OUTSAMPLETYPE";
+static const char* ENVVAR_DITHER = "_DITHER";
+static const char* ENVVAR_RTMEMORY = "_RTMEMORY";
+static const char* ENVVAR_STACKPREFAULT = "_STACKPREFAULT";
+static const char* ENVVAR_HANDOFF = "_HANDOFF";
+static const char* ENVVAR_SPIN = "_SPIN";
+static const char* ENVVAR_INLINE = "_INLINE";
+static const char* ENVVAR_PIPELINE = "_PIPELINE";
+static const char* ENVVAR_EXCLUSIVE = "_EXCLUSIVE";
+static const char* ENVVAR_TIMELINE = "_TIMELINE";
+static const char* ENVVAR_TIMELINE_SIZE = "_TIMELINE_SIZE";
+static const char* ENVVAR_CONTROL = "_CONTROL";
 static const char* DEFAULT_PREFIX = "ASIO";
 static const char* DEFAULT_INPORT = "input_";
 static const char* DEFAULT_OUTPORT = "output_";
 static const int   DEFAULT_NUMINPUTS = 2;
 static const int   DEFAULT_NUMOUTPUTS = 2;
 static const int   DEFAULT_AUTOCONNECT = -1;
+static const int   DEFAULT_DITHER = 1;
+static const int   DEFAULT_RTMEMORY = 1;
+static const int   DEFAULT_STACKPREFAULT = 256;     /* KiB */
+static const int   DEFAULT_FUTEX = 0;
+static const int   DEFAULT_SPIN = 20;               /* us */
+static const int   DEFAULT_INLINE = 1;
+static const int   DEFAULT_PIPELINE = 0;            /* periods */
+static const int   DEFAULT_EXCLUSIVE = 0;
+static const int   DEFAULT_TIMELINE = 0;
+static const int   DEFAULT_TIMELINE_SIZE = 256;     /* MiB */
+static const int   DEFAULT_CONTROL = 1;
+static const int   MAX_PIPELINE = 4;
+static const int   AUTO_MISSES = 2;                 /* in a second, to grow the auto pipeline */
+static const int   AUTO_CLEAN = 30;                 /* seconds without one, to shrink it */
+static const int   REBLOCK_MAX = 8;                 /* host buffers up to 8 times or 1/8 of JACK's */
+static const int   REBLOCK_MIN = 16;                /* but no smaller than this */
+static const int   EXCLUSIVE_MAX = 8192;            /* the largest period JACK takes */
 static const char* USERCFG = ".wineasiocfg";
 static const char* SITECFG = "/etc/default/wineasiocfg";
@@ -0,0 +1,99 @@
+/*
+ * Settings changed while the audio runs: two copies, one the reader is
+ * using and one for the writer, swapped without the reader taking a lock
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "snapshot.h"
+
+int snapshot_init(Snapshot *snapshot, size_t size)
+{
+    snapshot->size = size;
+    snapshot->gen = 0;
+    snapshot->held = SNAPSHOT_IDLE;
+    snapshot->copy[0] = calloc(1, size);
+    snapshot->copy[1] = calloc(1, size);
+    if (snapshot->copy[0] && snapshot->copy[1])
+        return 1;
+    snapshot_destroy(snapshot);
+    return 0;
+}
+
+void snapshot_destroy(Snapshot *snapshot)
+{
+    free(snapshot->copy[0]);
+    free(snapshot->copy[1]);
+    snapshot->copy[0] = snapshot->copy[1] = NULL;
+}
+
+/* Say which generation we are in before using it, and check it is still
+ * current after: a writer that looked at held before we set it has
+ * published since, and we go for the newer one.
+ */
+const void *snapshot_read(Snapshot *snapshot)
+{
+    unsigned int gen;
+
+    do
+    {
+        gen = snapshot->gen;
+        snapshot->held = gen;
+        __sync_synchronize();
+    } while (snapshot->gen != gen);
+    return snapshot->copy[gen & 1];
+}
+
+void snapshot_done(Snapshot *snapshot)
+{
+    __sync_synchronize();
+    snapshot->held = SNAPSHOT_IDLE;
+}
+
+void *snapshot_edit(Snapshot *snapshot, int timeout_ms)
+{
+    unsigned int gen = snapshot->gen;
+    struct timespec ms = { 0, 1000000 };
+    void *spare = snapshot->copy[(gen + 1) & 1];
+
+    /* the reader may still have the one before the current */
+    __sync_synchronize();
+    while (snapshot->held != SNAPSHOT_IDLE && snapshot->held != gen)
+    {
+        if (timeout_ms-- <= 0)
+            return NULL;
+        nanosleep(&ms, NULL);
+    }
+    memcpy(spare, snapshot->copy[gen & 1], snapshot->size);
+    return spare;
+}
+
+void snapshot_publish(Snapshot *snapshot)
+{
+    __sync_synchronize();
+    snapshot->gen++;
+}
+
+const void *snapshot_current(Snapshot *snapshot)
+{
+    return snapshot->copy[snapshot->gen & 1];
+}
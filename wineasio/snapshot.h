@@ -0,0 +1,57 @@
+/*
+ * Settings changed while the audio runs: two copies, one the reader is
+ * using and one for the writer, swapped without the reader taking a lock
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_SNAPSHOT_H
+#define __WINEASIO_SNAPSHOT_H
+
+#include <stddef.h>
+
+#define SNAPSHOT_IDLE   0xffffffffu
+
+/* One reader, the JACK thread, and one writer at a time.  The reader
+ * takes the current copy for a while, a cycle say, and lets go of it;
+ * the writer changes the spare and publishes it.  Before it touches the
+ * spare again it waits for the reader to let go of it, RCU style: the
+ * reader never waits at all.
+ */
+typedef struct _Snapshot {
+    void                *copy[2];
+    size_t              size;
+    volatile unsigned int gen;      /* copy[gen & 1] is current */
+    volatile unsigned int held;     /* the generation the reader has, or SNAPSHOT_IDLE */
+} Snapshot;
+
+/* both copies zeroed; returns 0 if there is no memory */
+extern int snapshot_init(Snapshot *snapshot, size_t size);
+extern void snapshot_destroy(Snapshot *snapshot);
+
+/* the reader's: the current copy, good until snapshot_done */
+extern const void *snapshot_read(Snapshot *snapshot);
+extern void snapshot_done(Snapshot *snapshot);
+
+/* The writer's: the spare, as a copy of the current one to change and
+ * publish.  NULL if the reader hasn't let go of it within timeout_ms.
+ */
+extern void *snapshot_edit(Snapshot *snapshot, int timeout_ms);
+extern void snapshot_publish(Snapshot *snapshot);
+
+/* the writer's look at the current copy */
+extern const void *snapshot_current(Snapshot *snapshot);
+
+#endif /* __WINEASIO_SNAPSHOT_H */
@@ -0,0 +1,168 @@
+/*
+ * Counters kept for each JACK client in shared memory, where tools outside
+ * the Windows process can read them
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+static void stats_name(char *name, size_t size, const char *client)
+{
+    char *p;
+
+    snprintf(name, size, "%s%.*s", STATS_PREFIX, STATS_NAME - 1, client);
+    for (p = name + 1; *p; p++)
+        if (*p == '/')
+            *p = '_';
+}
+
+Stats *stats_open(const char *client)
+{
+    Stats *stats = MAP_FAILED;
+    char name[sizeof(STATS_PREFIX) + STATS_NAME];
+    int fd;
+
+    stats_name(name, sizeof(name), client);
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        if (ftruncate(fd, sizeof(Stats)) == 0)
+            stats = mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+
+    if (stats != MAP_FAILED)
+    {
+        memset(stats, 0, sizeof(Stats));
+        stats->shared = 1;
+    }
+    else
+    {
+        shm_unlink(name);
+        if (!(stats = calloc(1, sizeof(Stats))))
+            return NULL;
+    }
+
+    stats->version = STATS_VERSION;
+    stats->pid = getpid();
+    snprintf(stats->client, sizeof(stats->client), "%s", client);
+    __sync_synchronize();
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+long long stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int stats_bucket(unsigned long long ns)
+{
+    int octave;
+
+    if (ns < 4)
+        return (int)ns;
+    octave = 63 - __builtin_clzll(ns);
+    if (octave > STATS_BUCKETS / 4)
+        return STATS_BUCKETS - 1;
+    return 4 * (octave - 1) + (int)((ns >> (octave - 2)) & 3);
+}
+
+void stats_stage(Stats *stats, int stage, long long ns)
+{
+    Histogram *h = &stats->stage[stage];
+
+    if (ns < 0)
+        ns = 0;
+    h->count[stats_bucket(ns)]++;
+    if (ns > h->max)
+        h->max = ns > 0xffffffffLL ? 0xffffffff : (unsigned int)ns;
+}
+
+long long stats_lap(Stats *stats, int stage, long long since)
+{
+    long long now = stats_now();
+
+    stats_stage(stats, stage, now - since);
+    return now;
+}
+
+/* the lowest time, in ns, bucket b takes */
+static double stats_bucket_ns(int b)
+{
+    if (b < 4)
+        return b;
+    return (double)(4 + b % 4) * (1ULL << (b / 4 - 1));
+}
+
+double stats_quantile(const unsigned int *count, unsigned int total, double q, unsigned int max)
+{
+    unsigned int want = (unsigned int)(total * q), sum = 0;
+    int b;
+
+    for (b = 0; b < STATS_BUCKETS; b++)
+    {
+        sum += count[b];
+        if (sum > want)
+            break;
+    }
+    if (b < STATS_BUCKETS - 1 && stats_bucket_ns(b + 1) < max)
+        return stats_bucket_ns(b + 1);
+    return max;
+}
+
+double stats_longest(const unsigned int *count, unsigned int max)
+{
+    int b;
+
+    for (b = STATS_BUCKETS - 1; b >= 0 && !count[b]; b--)
+        ;
+    if (b >= 0 && b < STATS_BUCKETS - 1 && stats_bucket_ns(b + 1) < max)
+        return stats_bucket_ns(b + 1);
+    return max;
+}
+
+void stats_close(Stats *stats)
+{
+    char name[sizeof(STATS_PREFIX) + STATS_NAME];
+
+    if (!stats)
+        return;
+
+    if (!stats->shared)
+    {
+        free(stats);
+        return;
+    }
+
+    stats_name(name, sizeof(name), stats->client);
+    shm_unlink(name);
+    munmap(stats, sizeof(Stats));
+}
@@ -0,0 +1,94 @@
+/*
+ * Counters kept for each JACK client in shared memory, where tools outside
+ * the Windows process can read them
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_STATS_H
+#define __WINEASIO_STATS_H
+
+/* /dev/shm/wineasio-<JACK client name>, with any '/' in the name made '_' */
+#define STATS_PREFIX    "/wineasio-"
+#define STATS_MAGIC     0x57415354      /* "WAST" */
+#define STATS_VERSION   2
+#define STATS_NAME      128
+
+/* Where a cycle's time goes.  Each stage is timed by one thread at a time */
+enum {
+    STAGE_WAKE,         /* JACK's cycle start to jack_process */
+    STAGE_INPUT,        /* JACK's inputs to the ASIO buffers or rings */
+    STAGE_HANDOFF,      /* waking the win32 thread, to it running */
+    STAGE_CONVERT,      /* the win32 thread between rings and ASIO buffers */
+    STAGE_CALLBACK,     /* the host's bufferSwitch */
+    STAGE_RETURN,       /* waking the JACK thread again, to it running */
+    STAGE_OUTPUT,       /* the ASIO buffers or rings to JACK's outputs */
+    STAGE_CYCLE,        /* all of jack_process */
+    STAGES
+};
+
+#define STAGE_NAMES     { "wake", "input", "handoff", "convert", "callback", "return", "output", "cycle" }
+
+/* Times in ns, four buckets to an octave: below 4 ns a bucket each, then
+ * bucket 4 * (octave - 1) + the two bits below the top one, where the
+ * octave is that top bit's.  The last bucket takes anything longer.
+ */
+#define STATS_BUCKETS   128
+
+typedef struct _Histogram {
+    volatile unsigned int count[STATS_BUCKETS];
+    volatile unsigned int max;          /* ns */
+} Histogram;
+
+/* Each counter has one writer; readers may see them mid-cycle.  Read by
+ * native 64 bit tools too: keep anything 64 bit on an 8 byte boundary.
+ */
+typedef struct _Stats {
+    unsigned int        magic;
+    unsigned int        version;
+    int                 pid;
+    int                 shared;         /* 0 if it couldn't be put in shared memory */
+    char                client[STATS_NAME];
+
+    volatile unsigned long long cycles; /* JACK cycles while started */
+    volatile unsigned int xruns;        /* JACK's xrun callbacks: late anywhere in the graph */
+    volatile unsigned int late;         /* the host's output wasn't there in time */
+
+    Histogram           stage[STAGES];
+} Stats;
+
+/* zeroed; NULL only if there isn't even private memory for it */
+extern Stats *stats_open(const char *client);
+extern void stats_close(Stats *stats);
+
+/* CLOCK_MONOTONIC, ns */
+extern long long stats_now(void);
+
+extern void stats_stage(Stats *stats, int stage, long long ns);
+
+/* time a stage from since to now, and return now for the next one */
+extern long long stats_lap(Stats *stats, int stage, long long since);
+
+/* The q'th quantile of total times counted by bucket, in ns: the top of
+ * the bucket it falls in, or the longest time, if that's less
+ */
+extern double stats_quantile(const unsigned int *count, unsigned int total, double q, unsigned int max);
+
+/* and the longest of them as near as the buckets tell: the top of the last
+ * one with anything in it, or max if that's less
+ */
+extern double stats_longest(const unsigned int *count, unsigned int max);
+
+#endif /* __WINEASIO_STATS_H */
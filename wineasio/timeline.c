@@ -0,0 +1,179 @@
+/*
+ * An opt-in trace of every stage of every cycle, streamed to a file for
+ * offline analysis of long sessions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "timeline.h"
+
+/* each stage is only ever timed by one thread at a time, and these queues are its */
+static const unsigned short stage_thread[STAGES] = {
+    TIMELINE_JACK,      /* wake */
+    TIMELINE_JACK,      /* input */
+    TIMELINE_HOST,      /* handoff */
+    TIMELINE_HOST,      /* convert */
+    TIMELINE_HOST,      /* callback */
+    TIMELINE_JACK,      /* return */
+    TIMELINE_JACK,      /* output */
+    TIMELINE_JACK,      /* cycle */
+};
+
+void timeline_span(Timeline *timeline, int stage, long long start, long long ns)
+{
+    SpanQueue *q = &timeline->queue[stage_thread[stage]];
+    unsigned long long head = q->head;
+    Span *s;
+
+    if (head - q->tail >= TIMELINE_QUEUE)
+    {
+        q->lost++;
+        return;
+    }
+    s = &q->span[head & (TIMELINE_QUEUE - 1)];
+    s->start = start;
+    s->duration = ns < 0 ? 0 : ns > 0xffffffffLL ? 0xffffffff : (unsigned int)ns;
+    s->stage = stage;
+    s->thread = stage_thread[stage];
+    __sync_synchronize();
+    q->head = head + 1;
+}
+
+/* everything queued so far into the file */
+static void timeline_drain(Timeline *timeline)
+{
+    TimelineHeader *h = timeline->header;
+    unsigned long long head, tail, lost = 0;
+    SpanQueue *q;
+    int i;
+
+    for (i = 0; i < TIMELINE_THREADS; i++)
+    {
+        q = &timeline->queue[i];
+        head = q->head;
+        __sync_synchronize();
+        for (tail = q->tail; tail != head; tail++)
+            timeline->span[h->written++ % h->capacity] = q->span[tail & (TIMELINE_QUEUE - 1)];
+        __sync_synchronize();
+        q->tail = tail;
+        lost += q->lost;
+    }
+    h->lost = lost;
+}
+
+static void *timeline_writer(void *arg)
+{
+    Timeline *timeline = arg;
+    struct timespec ts = { 0, 10000000 };
+
+    while (!timeline->closing)
+    {
+        nanosleep(&ts, NULL);
+        timeline_drain(timeline);
+    }
+    return NULL;
+}
+
+Timeline *timeline_open(const char *client, int megabytes)
+{
+    Timeline *timeline;
+    TimelineHeader *h;
+    char path[64 + STATS_NAME], *p;
+    unsigned long long capacity;
+    size_t size;
+    void *map;
+    int fd;
+
+    if (megabytes < 1)
+        megabytes = 1;
+    if (megabytes > TIMELINE_MAX_SIZE)
+        megabytes = TIMELINE_MAX_SIZE;
+    capacity = ((unsigned long long)megabytes << 20) / sizeof(Span);
+    size = sizeof(TimelineHeader) + capacity * sizeof(Span);
+    if (size != sizeof(TimelineHeader) + capacity * sizeof(Span))
+        return NULL;            /* wrapped, and the spans would be written past the mapping */
+
+    snprintf(path, sizeof(path), "/tmp/wineasio-%.*s.timeline", STATS_NAME - 1, client);
+    for (p = path + sizeof("/tmp/") - 1; *p; p++)
+        if (*p == '/')
+            *p = '_';
+    /* /tmp is everyone's: make a new file, and never through someone's symlink */
+    unlink(path);
+    if ((fd = open(path, O_CREAT | O_EXCL | O_RDWR | O_NOFOLLOW | O_CLOEXEC, 0644)) < 0)
+        return NULL;
+    /* the blocks now, not as the audio runs; where there's no fallocate, sparse */
+#ifdef __linux__
+    if (posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0)
+#else
+    if (ftruncate(fd, size) != 0)
+#endif
+    {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (!(timeline = calloc(1, sizeof(Timeline))))
+    {
+        munmap(map, size);
+        return NULL;
+    }
+    timeline->header = h = map;
+    timeline->span = (Span *)(h + 1);
+    timeline->size = size;
+
+    h->version = TIMELINE_VERSION;
+    h->pid = getpid();
+    h->span_size = sizeof(Span);
+    snprintf(h->client, sizeof(h->client), "%s", client);
+    h->written = 0;
+    h->capacity = capacity;
+    h->lost = 0;
+    __sync_synchronize();
+    h->magic = TIMELINE_MAGIC;
+
+    if (pthread_create(&timeline->writer, NULL, timeline_writer, timeline) != 0)
+    {
+        munmap(map, size);
+        free(timeline);
+        return NULL;
+    }
+    return timeline;
+}
+
+void timeline_close(Timeline *timeline)
+{
+    if (!timeline)
+        return;
+    timeline->closing = 1;
+    pthread_join(timeline->writer, NULL);
+    timeline_drain(timeline);
+    munmap(timeline->header, timeline->size);
+    free(timeline);
+}
@@ -0,0 +1,96 @@
+/*
+ * An opt-in trace of every stage of every cycle, streamed to a file for
+ * offline analysis of long sessions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_TIMELINE_H
+#define __WINEASIO_TIMELINE_H
+
+#include <pthread.h>
+
+#include "stats.h"
+
+/* /tmp/wineasio-<JACK client name>.timeline, with any '/' in the name made '_' */
+#define TIMELINE_MAGIC      0x5741544c      /* "WATL" */
+#define TIMELINE_VERSION    1
+#define TIMELINE_QUEUE      16384           /* spans, a power of two: 40 ms of cycles at 16 frames */
+#define TIMELINE_MAX_SIZE   1024            /* MiB, so the mapping fits a 32 bit process's size_t */
+
+/* which thread a span came from, by the queue it went through */
+enum {
+    TIMELINE_JACK,
+    TIMELINE_HOST,      /* the host's side: the win32 thread, or JACK's when the callback is inline */
+    TIMELINE_THREADS
+};
+
+/* One stage of one cycle.  Times are CLOCK_MONOTONIC, the same in every
+ * process, so the files of several clients line up.
+ */
+typedef struct _Span {
+    unsigned long long  start;          /* ns */
+    unsigned int        duration;       /* ns */
+    unsigned short      stage;
+    unsigned short      thread;
+} Span;
+
+/* The file: this header, then capacity spans, written round and round.
+ * Span written % capacity is the next to go; with written past capacity
+ * the oldest are overwritten.  Read by native 64 bit tools too: keep
+ * anything 64 bit on an 8 byte boundary.
+ */
+typedef struct _TimelineHeader {
+    unsigned int        magic;
+    unsigned int        version;
+    int                 pid;
+    unsigned int        span_size;
+    char                client[STATS_NAME];
+    volatile unsigned long long written;
+    unsigned long long  capacity;
+    volatile unsigned long long lost;   /* dropped with a queue full */
+} TimelineHeader;
+
+/* Single producer, single consumer: the audio thread only moves head, the
+ * writer thread only tail.  A span that doesn't fit is counted and dropped.
+ */
+typedef struct _SpanQueue {
+    volatile unsigned long long head;
+    char                pad1[56];
+    volatile unsigned long long tail;
+    char                pad2[56];
+    volatile unsigned long long lost;
+    Span                span[TIMELINE_QUEUE];
+} SpanQueue;
+
+typedef struct _Timeline {
+    SpanQueue           queue[TIMELINE_THREADS];
+    TimelineHeader      *header;        /* the mapped file */
+    Span                *span;          /* in it */
+    size_t              size;
+    pthread_t           writer;
+    volatile int        closing;
+} Timeline;
+
+/* Preallocate a file of up to megabytes (1 to TIMELINE_MAX_SIZE) and start the thread that
+ * empties the queues into it.  NULL if the file can't be made.
+ */
+extern Timeline *timeline_open(const char *client, int megabytes);
+extern void timeline_close(Timeline *timeline);
+
+/* a stage that ran from start for ns; from the one thread timing that stage */
+extern void timeline_span(Timeline *timeline, int stage, long long start, long long ns);
+
+#endif /* __WINEASIO_TIMELINE_H */
@@ -0,0 +1,147 @@
+/*
+ * timing-test: the host's sample positions and times over a simulated
+ * JACK frame clock, through period changes, xruns and wraparound
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Native, not Wine: gcc -o timing-test timing-test.c timing.c, or make check */
+
+#include <stdio.h>
+
+#include "config.h"
+#include "port.h"
+
+#include "timing.h"
+
+#define RATE        48000
+#define TICK_NS     (1000000000.0 / RATE)
+#define OFFSET_NS   123456789012LL
+#define BLOCK       128             /* the host's buffer size */
+#define CYCLES      20000
+
+/* JACK's frame time wraps; start just short of it, a while after boot */
+#define FRAME_START 0xffff0000u
+#define USECS_START 1000000ULL
+
+static int failures;
+
+static void fail(const char *run, long cycle, const char *what, long long was, long long now)
+{
+    if (failures++ < 10)
+        fprintf(stderr, "%s, cycle %ld: %s, %lld then %lld\n", run, cycle, what, was, now);
+}
+
+/* as jack_get_cycle_times would have it: the DLL's time to the nearest us,
+ * and with noise, up to 5 us either way
+ */
+static unsigned long long jack_usecs(unsigned long long frames, int noise, unsigned int *seed)
+{
+    unsigned long long usecs = USECS_START + (frames * 1000000ULL + RATE / 2) / RATE;
+
+    *seed = *seed * 1103515245u + 12345u;
+    return noise ? usecs + (*seed >> 16) % 11 - 5 : usecs;
+}
+
+/* One run of CYCLES JACK cycles, with the host's blocks checked against
+ * where they fall at JACK's rate: to within jitter ns
+ */
+static void run(const char *name, int noise, double jitter)
+{
+    static const unsigned int periods[] = { 256, 64, 1024, 128, 32, 512 };
+    Timing timing = { 0 };
+    Stamp stamp = { 0 };
+    Cycle cycle;
+    unsigned long long elapsed = 0;     /* frames since start, never wraps */
+    unsigned long long first = 0;       /* of the last cycle */
+    unsigned int cycle_frame = 0;
+    long long frame_clock = 0, stream_frames = 0, host_frames = 0;
+    long long last_position = -1, last_ns = -1;
+    double worst = 0, off;
+    unsigned int seed = 1;
+    long i;
+
+    timing.offset = OFFSET_NS;
+
+    for (i = 0; i < CYCLES; i++)
+    {
+        unsigned int nframes = periods[(i / 1000) % (sizeof(periods) / sizeof(periods[0]))];
+
+        /* now and then JACK skips a cycle or three */
+        if (i % 97 == 13)
+            elapsed += nframes * (1 + i % 3);
+        first = elapsed;
+
+        cycle.stream = stream_frames;
+        cycle.frames = nframes;
+        cycle.usecs = jack_usecs(elapsed, noise, &seed);
+        cycle.period_usecs = nframes * 1000000.0f / RATE;
+        frame_clock = timing_advance(frame_clock, &cycle_frame,
+            (unsigned int)(FRAME_START + elapsed), !stream_frames);
+        cycle.frame = frame_clock;
+        cycle.rolling = 1;
+        cycle.transport = frame_clock;
+        timing_publish(&timing, &cycle);
+        stream_frames += nframes;
+        elapsed += nframes;
+
+        /* the host falls a cycle behind every so often, and reads a later one */
+        if (i % 5 == 2)
+            continue;
+
+        while (host_frames + BLOCK <= stream_frames)
+        {
+            long long position, ns;
+
+            timing_read(&timing, &cycle);
+            stamp_set(&stamp, timing_position(&cycle, host_frames),
+                timing_ns(&timing, &cycle, host_frames));
+            stamp_get(&stamp, &position, &ns);
+
+            if (position <= last_position)
+                fail(name, i, "position went back", last_position, position);
+            if (ns <= last_ns)
+                fail(name, i, "time went back", last_ns, ns);
+
+            /* the time is the position at JACK's rate, from the clock's start */
+            off = ns - (OFFSET_NS + USECS_START * 1000.0 + position * TICK_NS);
+            if (off < 0)
+                off = -off;
+            if (off > worst)
+                worst = off;
+            if (off >= jitter)
+                fail(name, i, "jitter, ns", (long long)jitter, (long long)off);
+
+            last_position = position;
+            last_ns = ns;
+            host_frames += BLOCK;
+        }
+    }
+
+    if (frame_clock != (long long)first)
+        fail(name, i, "frame clock lost count", first, frame_clock);
+
+    printf("timing-test %s: %ld cycles, %lld host blocks, jitter up to %.0f ns\n",
+        name, i, host_frames / BLOCK, worst);
+}
+
+int main(void)
+{
+    run("clean", 0, 1000.0);
+    run("noisy", 1, TICK_NS);
+
+    printf("timing-test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Where JACK's cycles fall in time, passed from the JACK thread to the
+ * one that timestamps the host's buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "port.h"
+
+#include "timing.h"
+
+long long timing_advance(long long clock, unsigned int *last, unsigned int frames, int first)
+{
+    clock = first ? 0 : clock + (unsigned int)(frames - *last);
+    *last = frames;
+    return clock;
+}
+
+void timing_publish(Timing *timing, const Cycle *cycle)
+{
+    timing->seq++;
+    __sync_synchronize();
+    timing->cycle = *cycle;
+    __sync_synchronize();
+    timing->seq++;
+}
+
+void timing_read(Timing *timing, Cycle *cycle)
+{
+    unsigned int seq;
+
+    do
+    {
+        seq = timing->seq;
+        __sync_synchronize();
+        *cycle = timing->cycle;
+        __sync_synchronize();
+    }
+    while ((seq & 1) || seq != timing->seq);
+}
+
+/* Frames before or after the cycle's first are placed at JACK's rate for
+ * the cycle, which is as smooth as JACK's own estimate of it.
+ */
+long long timing_ns(const Timing *timing, const Cycle *cycle, long long stream)
+{
+    double ns = cycle->usecs * 1000.0;
+
+    if (cycle->frames)
+        ns += (stream - cycle->stream) * (cycle->period_usecs * 1000.0 / cycle->frames);
+    return (long long)ns + timing->offset;
+}
+
+long long timing_position(const Cycle *cycle, long long stream)
+{
+    return cycle->frame + (stream - cycle->stream);
+}
+
+/* A stopped transport stays where it is; a rolling one only runs back to
+ * where it started from
+ */
+long long timing_transport(const Cycle *cycle, long long stream)
+{
+    long long frame = cycle->transport;
+
+    if (cycle->rolling)
+        frame += stream - cycle->stream;
+    return frame > 0 ? frame : 0;
+}
+
+void stamp_set(Stamp *stamp, long long position, long long ns)
+{
+    stamp->seq++;
+    __sync_synchronize();
+    stamp->position = position;
+    stamp->ns = ns;
+    __sync_synchronize();
+    stamp->seq++;
+}
+
+void stamp_get(Stamp *stamp, long long *position, long long *ns)
+{
+    unsigned int seq;
+
+    do
+    {
+        seq = stamp->seq;
+        __sync_synchronize();
+        *position = stamp->position;
+        *ns = stamp->ns;
+        __sync_synchronize();
+    }
+    while ((seq & 1) || seq != stamp->seq);
+}
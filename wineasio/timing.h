@@ -0,0 +1,73 @@
+/*
+ * Where JACK's cycles fall in time, passed from the JACK thread to the
+ * one that timestamps the host's buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_TIMING_H
+#define __WINEASIO_TIMING_H
+
+/* One JACK cycle, as jack_get_cycle_times saw it */
+typedef struct _Cycle {
+    long long           stream;         /* frames queued for the host before this cycle */
+    long long           frame;          /* JACK's frame time of its first frame, from start */
+    unsigned long long  usecs;          /* JACK's (DLL filtered) time of its first frame */
+    float               period_usecs;
+    unsigned int        frames;         /* in the cycle */
+    int                 rolling;        /* JACK's transport */
+    long long           transport;      /* and its frame at the cycle's first */
+} Cycle;
+
+/* The latest cycle, behind a sequence count: the JACK thread is the only
+ * writer, and readers retry if it was writing while they copied
+ */
+typedef struct _Timing {
+    volatile unsigned int seq;          /* odd while the cycle is being written */
+    Cycle               cycle;
+    long long           offset;         /* ns, the host's time base less JACK's */
+} Timing;
+
+/* Move a frame clock counted from start on to the cycle at JACK's 32 bit
+ * frame time frames, from the last one's at *last: by as far as JACK has,
+ * so xruns count, through wraparound.  The first cycle starts it at 0.
+ */
+extern long long timing_advance(long long clock, unsigned int *last, unsigned int frames, int first);
+
+extern void timing_publish(Timing *timing, const Cycle *cycle);
+extern void timing_read(Timing *timing, Cycle *cycle);
+
+/* in the host's time base, ns: when frame stream of what was queued for it came in */
+extern long long timing_ns(const Timing *timing, const Cycle *cycle, long long stream);
+
+/* and its sample position: JACK's frame time, so xruns move it on too */
+extern long long timing_position(const Cycle *cycle, long long stream);
+
+/* and where JACK's transport was then */
+extern long long timing_transport(const Cycle *cycle, long long stream);
+
+/* The position and time of the host's current block, which it may ask
+ * for from any thread; written only by whoever calls it back
+ */
+typedef struct _Stamp {
+    volatile unsigned int seq;
+    long long           position;
+    long long           ns;
+} Stamp;
+
+extern void stamp_set(Stamp *stamp, long long position, long long ns);
+extern void stamp_get(Stamp *stamp, long long *position, long long *ns);
+
+#endif /* __WINEASIO_TIMING_H */
@@ -0,0 +1,142 @@
+/*
+ * wineasio-timeline: WineASIO timeline files to Chrome trace JSON
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Native, not Wine: gcc -o wineasio-timeline wineasio-timeline.c
+ *
+ * wineasio-timeline /tmp/wineasio-*.timeline > trace.json, then open
+ * trace.json in chrome://tracing or ui.perfetto.dev.  Every file is a
+ * process, its JACK and host threads each a track.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeline.h"
+
+static const char *stage_names[STAGES] = STAGE_NAMES;
+static const char *thread_names[TIMELINE_THREADS] = { "jack", "host" };
+
+static int events;
+
+static void event_start(void)
+{
+    printf("%s\n", events++ ? "," : "");
+}
+
+/* a JSON string, from a client name */
+static void print_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < ' ')
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static int convert(const char *path)
+{
+    TimelineHeader *h;
+    const Span *span, *s;
+    unsigned long long written, first, i;
+    struct stat st;
+    void *map;
+    int fd, t;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    map = st.st_size >= (off_t)sizeof(TimelineHeader)
+        ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    h = map;
+    if (map == MAP_FAILED || h->magic != TIMELINE_MAGIC || h->version != TIMELINE_VERSION
+        || h->span_size != sizeof(Span)
+        || sizeof(TimelineHeader) + h->capacity * sizeof(Span) > (unsigned long long)st.st_size)
+    {
+        fprintf(stderr, "%s: not a WineASIO timeline\n", path);
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        return 1;
+    }
+    span = (const Span *)(h + 1);
+
+    /* still being written: no more than is there now */
+    written = h->written;
+    first = written > h->capacity ? written - h->capacity : 0;
+    if (first)
+        fprintf(stderr, "%s: wrapped, the first %llu spans are gone\n", path, first);
+    if (h->lost)
+        fprintf(stderr, "%s: %llu spans lost to full queues\n", path, h->lost);
+
+    event_start();
+    printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", h->pid);
+    print_string(h->client);
+    printf("}}");
+    for (t = 0; t < TIMELINE_THREADS; t++)
+    {
+        event_start();
+        printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            h->pid, t, thread_names[t]);
+    }
+
+    for (i = first; i < written; i++)
+    {
+        s = &span[i % h->capacity];
+        if (s->stage >= STAGES || s->thread >= TIMELINE_THREADS)
+            continue;
+        event_start();
+        printf("{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%u.%03u}",
+            stage_names[s->stage], h->pid, s->thread,
+            s->start / 1000, s->start % 1000, s->duration / 1000, s->duration % 1000);
+    }
+
+    munmap(map, st.st_size);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, failed = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: wineasio-timeline file... > trace.json\n");
+        return 2;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (i = 1; i < argc; i++)
+        failed |= convert(argv[i]);
+    printf("\n]}\n");
+    return failed;
+}
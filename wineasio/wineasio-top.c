@@ -0,0 +1,201 @@
+/*
+ * wineasio-top: where each WineASIO client's JACK cycles go, live
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Native, not Wine: gcc -o wineasio-top wineasio-top.c stats.c -lrt */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#define MAX_CLIENTS 32
+
+/* a client's segment, and its histograms as last shown */
+typedef struct _Client {
+    char            name[NAME_MAX + 2];
+    Stats           *stats;
+    Histogram       last[STAGES];
+    int             seen;
+} Client;
+
+static Client clients[MAX_CLIENTS];
+static int num_clients;
+
+static const char *stage_names[STAGES] = STAGE_NAMES;
+
+static Stats *attach(const char *name)
+{
+    struct stat st;
+    Stats *stats;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(Stats))
+    {
+        close(fd);
+        return NULL;
+    }
+    stats = mmap(NULL, sizeof(Stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED)
+        return NULL;
+
+    if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION)
+    {
+        munmap(stats, sizeof(Stats));
+        return NULL;
+    }
+    return stats;
+}
+
+/* Attach to new segments in /dev/shm, and let go of those whose host has gone */
+static void scan(void)
+{
+    char name[NAME_MAX + 2];
+    struct dirent *d;
+    DIR *dir;
+    int i;
+
+    for (i = 0; i < num_clients; i++)
+        clients[i].seen = 0;
+
+    if ((dir = opendir("/dev/shm")))
+    {
+        while ((d = readdir(dir)))
+        {
+            if (strncmp(d->d_name, STATS_PREFIX + 1, sizeof(STATS_PREFIX) - 2))
+                continue;
+            snprintf(name, sizeof(name), "/%s", d->d_name);
+
+            for (i = 0; i < num_clients; i++)
+                if (!strcmp(clients[i].name, name))
+                    break;
+            if (i == num_clients)
+            {
+                if (num_clients == MAX_CLIENTS || !(clients[i].stats = attach(name)))
+                    continue;
+                snprintf(clients[i].name, sizeof(clients[i].name), "%s", name);
+                memset(clients[i].last, 0, sizeof(clients[i].last));
+                num_clients++;
+            }
+            clients[i].seen = 1;
+        }
+        closedir(dir);
+    }
+
+    for (i = 0; i < num_clients; )
+    {
+        if (clients[i].seen && (kill(clients[i].stats->pid, 0) == 0 || errno == EPERM))
+        {
+            i++;
+            continue;
+        }
+        munmap(clients[i].stats, sizeof(Stats));
+        clients[i] = clients[--num_clients];
+    }
+}
+
+static void show(Client *c)
+{
+    unsigned int count[STATS_BUCKETS], total, longest, max;
+    Histogram *h;
+    int s, b;
+
+    printf("%-40.40s pid %-7d %12llu cycles %6u xruns %6u late\n", c->stats->client,
+        c->stats->pid, c->stats->cycles, c->stats->xruns, c->stats->late);
+    printf("    %-10s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us");
+
+    for (s = 0; s < STAGES; s++)
+    {
+        h = &c->stats->stage[s];
+        total = 0;
+        for (b = 0; b < STATS_BUCKETS; b++)
+        {
+            count[b] = h->count[b] - c->last[s].count[b];
+            c->last[s].count[b] = h->count[b];
+            total += count[b];
+        }
+
+        /* a new longest came in this window; else the window's buckets bound its own */
+        longest = h->max;
+        max = longest > c->last[s].max ? longest : (unsigned int)stats_longest(count, longest);
+        c->last[s].max = longest;
+        if (!total)
+        {
+            printf("    %-10s %10u\n", stage_names[s], total);
+            continue;
+        }
+        printf("    %-10s %10u %10.1f %10.1f %10.1f\n", stage_names[s], total,
+            stats_quantile(count, total, 0.5, max) / 1000.0,
+            stats_quantile(count, total, 0.99, max) / 1000.0, max / 1000.0);
+    }
+    printf("\n");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: wineasio-top [-1] [seconds]\n"
+                    "  -1        show once and exit\n"
+                    "  seconds   between refreshes, default 1\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    double interval = 1;
+    int once = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-1"))
+            once = 1;
+        else if ((interval = atof(argv[i])) <= 0)
+            usage();
+    }
+
+    while (1)
+    {
+        scan();
+        if (!once)
+            printf("\033[H\033[J");
+        if (once)
+            printf("wineasio-top: %d client%s, percentiles since each started\n\n",
+                num_clients, num_clients == 1 ? "" : "s");
+        else
+            printf("wineasio-top: %d client%s, percentiles over the last %g s\n\n",
+                num_clients, num_clients == 1 ? "" : "s", interval);
+        for (i = 0; i < num_clients; i++)
+            show(&clients[i]);
+        fflush(stdout);
+        if (once)
+            return 0;
+        usleep((useconds_t)(interval * 1000000));
+    }
+}
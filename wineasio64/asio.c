@@ -19,6 +19,8 @@
 #include "config.h"
 #include "port.h"
 #include "common.h"
+#include "convert.h"
+#include "arena.h"
 
 //#include <stdarg.h>
 #include <stdio.h>
@@ -52,6 +54,14 @@ static DWORD CALLBACK win32_callback(LPVOID arg);
 static GUID const CLSID_WineASIO = {
 0x48d0c522, 0xbfcc, 0x45cc, { 0x8b, 0x84, 0x17, 0xf2, 0x5f, 0x33, 0xe6, 0xe8 } };
 
+/* one of the converters' names, or "auto" (float32, unless the host turns out to be pre-ASIO 2.0) */
+static const char* ENVVAR_SAMPLETYPE = "ASIO_SAMPLETYPE";
+static const char* ENVVAR_INSAMPLETYPE = "ASIO_INSAMPLETYPE";
+static const char* ENVVAR_OUTSAMPLETYPE = "ASIO_OUTSAMPLETYPE";
+static const char* ENVVAR_DITHER = "ASIO_DITHER";
+static const char* ENVVAR_RTMEMORY = "ASIO_RTMEMORY";
+static const char* ENVVAR_STACKPREFAULT = "ASIO_STACKPREFAULT";     /* KiB */
+
 #define twoRaisedTo32           4294967296.0
 #define twoRaisedTo32Reciprocal	(1.0 / twoRaisedTo32)
 
@@ -128,7 +138,7 @@ enum
 
 typedef struct _Channel {
    ASIOBool active;
-   int *buffer;
+   char *buffer;
 } Channel;
 
 struct IWineASIOImpl
@@ -153,6 +163,13 @@ struct IWineASIOImpl
     BOOL                time_info_mode;
     BOOL                tc_read;
     long                state;
+    int                 in_format;      /* what getChannelInfo reports */
+    int                 out_format;
+    int                 in_buffer_format;   /* what the current buffers hold */
+    int                 out_buffer_format;
+    BOOL                sample_auto;
+    BOOL                dither;
+    unsigned int        dither_state[DITHER_LANES];
 
     /* pointer to start of shared memory buffer */
     unsigned int        inputs;
@@ -170,10 +187,41 @@ struct IWineASIOImpl
     BOOL                terminate;
     Channel             *input;
     Channel             *output;
+    Arena               arena;          /* the active channels' buffers */
+
+    /* RT memory */
+    BOOL                rt_memory;      /* lock and prefault everything the callback touches */
+    int                 stack_prefault; /* KiB of callback thread stack to prefault */
+    Faults              faults;         /* seen by the callback thread while running */
+
+    /* outputReady */
+    BOOL                output_ready;   /* the host calls it */
+    BOOL                in_callback;    /* the host is in bufferSwitch */
+    BOOL                output_posted;  /* and has already let jackbridge go */
+
+    /* period changes */
+    long                period_told;    /* the period the host was last asked to change to */
+
+    /* dropouts, as counted by jackbridge */
+    unsigned int        xruns_told;
+    unsigned int        late_told;
+
+    /* the graph's latency, as jackbridge sees it */
+    unsigned int        capture_told;
+    unsigned int        playback_told;
 } This;
 
 typedef struct IWineASIOImpl              IWineASIOImpl;
 
+static const ASIOSampleType asio_sample_types[SampleFormats] =
+{
+    ASIOSTInt16LSB,
+    ASIOSTInt24LSB,
+    ASIOSTInt32LSB,
+    ASIOSTFloat32LSB,
+    ASIOSTFloat64LSB
+};
+
 static ULONG WINAPI IWineASIOImpl_AddRef(LPWINEASIO iface)
 {
     ULONG ref = InterlockedIncrement(&(This.ref));
@@ -212,12 +260,49 @@ static HRESULT WINAPI IWineASIOImpl_QueryInterface(LPWINEASIO iface, REFIID riid
     return E_NOINTERFACE;
 }
 
+static int get_sampleformat(const char *var, int defval)
+{
+    char *envi = getenv(var);
+    int format;
+
+    if (envi == NULL)
+        return defval;
+
+    if (strcasecmp(envi, "auto") == 0)
+    {
+        This.sample_auto = TRUE;
+        return SampleFloat32;
+    }
+    if ((format = convert_lookup(envi)) < 0)
+    {
+        WARN("unknown sample type '%s'\n", envi);
+        return defval;
+    }
+    return format;
+}
+
+/* Keep the buffers, the shared memory and our own state resident, so the
+ * callback does not page fault.  mlock can fail on a low RLIMIT_MEMLOCK;
+ * the pages are still touched.
+ */
+static void lock_memory(void)
+{
+    if (!mem_lock(&This, sizeof(This))
+        || !mem_lock(This.input, This.inputs * sizeof(Channel))
+        || !mem_lock(This.output, This.outputs * sizeof(Channel))
+        || !mem_lock(This.arena.base, This.arena.size)
+        || !mem_lock(This.infoblock, sizeof(InfoBlock))
+        || !mem_lock(This.inputblock, sizeof(float) * MAX_FRAMES * (This.inputs + This.outputs)))
+        WARN("couldn't lock the buffers, check RLIMIT_MEMLOCK\n");
+}
+
 WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *sysHandle))
 {
-    int i,j;
+    int i;
     int handle;
 
     float *memblock;
+    char *envi;
 
     if ((handle = shm_open("wineasio-info", O_RDWR, 0666)) == -1) 
     {
@@ -244,21 +329,25 @@ WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *
        return ASIOFalse;
     }
     
-    ftruncate(handle, sizeof(float)* This.block_frames * (This.inputs + This.outputs));
+    ftruncate(handle, sizeof(float)* MAX_FRAMES * (This.inputs + This.outputs));
     memblock = (float *)mmap(0, 
-                sizeof(float) * This.block_frames * (This.inputs + This.outputs),
+                sizeof(float) * MAX_FRAMES * (This.inputs + This.outputs),
                 PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
     close(handle);
 
     TRACE("mem block allocated");
 
     This.inputblock = memblock;
-    This.outputblock = memblock + This.inputs * This.block_frames;
+    This.outputblock = memblock + This.inputs * MAX_FRAMES;
 
     printf("in = %p, out = %p\n", This.inputblock, This.outputblock);
 
     This.input_latency = This.block_frames;
     This.output_latency = This.block_frames * 2;
+    This.output_ready = FALSE;
+    This.in_callback = FALSE;
+    This.output_posted = FALSE;
+    This.period_told = 0;
     This.miliseconds = (long)((double)(This.block_frames * 1000) / This.sample_rate);
     This.callbacks = NULL;
     This.sample_position = 0;
@@ -269,7 +358,21 @@ WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *
     This.terminate = FALSE;
     This.state = Init;
 
+    This.sample_auto = FALSE;
+    i = get_sampleformat(ENVVAR_SAMPLETYPE, SampleInt32);
+    This.in_format = This.in_buffer_format = get_sampleformat(ENVVAR_INSAMPLETYPE, i);
+    This.out_format = This.out_buffer_format = get_sampleformat(ENVVAR_OUTSAMPLETYPE, i);
+    envi = getenv(ENVVAR_DITHER);
+    This.dither = envi == NULL || strcasecmp(envi, "true") == 0;
+    convert_seed_dither(This.dither_state);
+    envi = getenv(ENVVAR_RTMEMORY);
+    This.rt_memory = envi == NULL || strcasecmp(envi, "true") == 0;
+    envi = getenv(ENVVAR_STACKPREFAULT);
+    This.stack_prefault = envi ? atoi(envi) : 256;
+    mem_faults_reset(&This.faults);
+
     TRACE("sample rate: %f\n", This.sample_rate);
+    TRACE("sample conversion: %s\n", convert_init());
 
     // initialize input buffers
 
@@ -277,9 +380,7 @@ WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *
     for (i=0; i<This.inputs; i++) {
         
         This.input[i].active = ASIOFalse;
-        This.input[i].buffer = HeapAlloc(GetProcessHeap(), 0, 2 * This.block_frames * sizeof(int));
-        for (j=0; j<This.block_frames * 2; j++)
-            This.input[i].buffer[j] = 0;
+        This.input[i].buffer = NULL;
     }
 
     // initialize output buffers
@@ -287,9 +388,7 @@ WRAP_THISCALL( ASIOBool __stdcall, IWineASIOImpl_init, (LPWINEASIO iface, void *
     This.output =  HeapAlloc(GetProcessHeap(), 0, sizeof(Channel) * This.outputs);
     for (i=0; i<This.outputs; i++) {
         This.output[i].active = ASIOFalse;
-        This.output[i].buffer = HeapAlloc(GetProcessHeap(), 0, 2 * This.block_frames * sizeof(int));
-        for (j=0; j<2*This.block_frames; j++)
-            This.output[i].buffer[j] = 0;
+        This.output[i].buffer = NULL;
     }
 
     This.semaphore1 = sem_open("wineasio-sem1", O_RDWR);
@@ -323,6 +422,11 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_start, (LPWINEASIO iface))
         This.system_time.lo = 0;
         This.system_time.hi = 0;
 
+        mem_faults_reset(&This.faults);
+        This.infoblock->minor_faults = This.infoblock->major_faults = 0;
+        This.xruns_told = This.infoblock->xruns;
+        This.late_told = This.infoblock->late;
+
         This.state = Run;
         TRACE("started\n");
 
@@ -337,6 +441,11 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_stop, (LPWINEASIO iface))
 
     This.state = Exit;
 
+    if (This.rt_memory)
+        TRACE("page faults while running: callback thread %ld minor %ld major, bridge %u minor %u major\n",
+            This.faults.minor, This.faults.major, This.infoblock->minor_faults, This.infoblock->major_faults);
+    TRACE("%u xruns, %u late callbacks so far\n", This.infoblock->xruns, This.infoblock->late);
+
     return ASE_OK;
 }
 
@@ -355,11 +464,15 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getChannels, (LPWINEASIO iface
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getLatencies, (LPWINEASIO iface, long *inputLatency, long *outputLatency))
 {
 
+    /* our buffering, and the latency of what jackbridge's ports are connected to */
+    This.capture_told = This.infoblock->capture_latency;
+    This.playback_told = This.infoblock->playback_latency;
+
     if (inputLatency)
-        *inputLatency = This.input_latency;
+        *inputLatency = This.input_latency + This.capture_told;
 
     if (outputLatency)
-        *outputLatency = This.output_latency;
+        *outputLatency = This.output_latency + This.playback_told;
 
     return ASE_OK;
 }
@@ -367,14 +480,15 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getLatencies, (LPWINEASIO ifac
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getBufferSize, (LPWINEASIO iface, long *minSize, long *maxSize, long *preferredSize, long *granularity))
 {
 
+    /* JACK's period now, which may have changed since init */
     if (minSize)
-        *minSize = This.block_frames;
+        *minSize = This.infoblock->buffer_frames;
 
     if (maxSize)
-        *maxSize = This.block_frames;
+        *maxSize = This.infoblock->buffer_frames;
 
     if (preferredSize)
-        *preferredSize = This.block_frames;
+        *preferredSize = This.infoblock->buffer_frames;
 
     if (granularity)
         *granularity = 0;
@@ -467,8 +581,7 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_getChannelInfo, (LPWINEASIO if
     if (info->channel < 0 || (info->isInput ? info->channel >= This.inputs : info->channel >= This.outputs))
         return ASE_InvalidParameter;
 
-//    info->type = ASIOSTFloat32LSB;
-    info->type = ASIOSTInt32LSB;
+    info->type = asio_sample_types[info->isInput ? This.in_format : This.out_format];
     info->channelGroup = 0;
 
     if (info->isInput)
@@ -497,23 +610,41 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_disposeBuffers, (LPWINEASIO if
     for (i = 0; i < This.inputs; i++)
     {
         This.input[i].active = ASIOFalse;
+        This.input[i].buffer = NULL;
     }
 
     for (i = 0; i < This.outputs; i++)
     {
         This.output[i].active = ASIOFalse;
+        This.output[i].buffer = NULL;
     }
 
+    arena_destroy(&This.arena);
+
     return ASE_OK;
 }
 
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO iface, ASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, ASIOCallbacks *callbacks))
 {
     ASIOBufferInfo * info = bufferInfos;
+    size_t in_size, out_size, total = 0;
     int i;
 
     This.block_frames = bufferSize;
     This.miliseconds = (long)((double)(This.block_frames * 1000) / This.sample_rate);
+    This.period_told = 0;
+
+    /* until the host asks for outputReady again */
+    This.output_ready = FALSE;
+    This.output_latency = This.block_frames * 2;
+    This.infoblock->output_periods = 2;
+
+    /* the host has already asked getChannelInfo for the type, so these buffers hold that */
+    This.in_buffer_format = This.in_format;
+    This.out_buffer_format = This.out_format;
+
+    in_size = 2 * This.block_frames * converters[This.in_buffer_format].size;
+    out_size = 2 * This.block_frames * converters[This.out_buffer_format].size;
 
     for (i = 0; i < numChannels; i++, info++)
     {
@@ -526,9 +657,7 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
             }
 
             This.input[info->channelNum].active = ASIOTrue;
-            info->buffers[0] = &This.input[info->channelNum].buffer[0];
-            info->buffers[1] = &This.input[info->channelNum].buffer[This.block_frames];
-
+            total += arena_slice(in_size);
         }
         else
         {
@@ -539,12 +668,35 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
             }
 
             This.output[info->channelNum].active = ASIOTrue;
-            info->buffers[0] = &This.output[info->channelNum].buffer[0];
-            info->buffers[1] = &This.output[info->channelNum].buffer[This.block_frames];
-
+            total += arena_slice(out_size);
         }
     }
 
+    /* one cache-aligned block for the active channels, in the order the callback visits them */
+    if (!arena_create(&This.arena, total))
+    {
+        WARN("no buffer memory\n");
+        goto ERROR_MEM;
+    }
+
+    for (i = 0; i < This.inputs; i++)
+        if (This.input[i].active == ASIOTrue)
+            This.input[i].buffer = arena_take(&This.arena, in_size);
+    for (i = 0; i < This.outputs; i++)
+        if (This.output[i].active == ASIOTrue)
+            This.output[i].buffer = arena_take(&This.arena, out_size);
+
+    if (This.rt_memory)
+        lock_memory();
+
+    for (i = 0, info = bufferInfos; i < numChannels; i++, info++)
+    {
+        Channel *c = info->isInput ? &This.input[info->channelNum] : &This.output[info->channelNum];
+
+        info->buffers[0] = c->buffer;
+        info->buffers[1] = c->buffer + (info->isInput ? in_size : out_size) / 2;
+    }
+
     This.callbacks = callbacks;
 
     if (This.callbacks->asioMessage)
@@ -567,6 +719,20 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
         }
         else
             This.time_info_mode = FALSE;
+
+        /* float32 only arrived with ASIO 2.0; ask an older host to reset and see int32 instead */
+        if (This.sample_auto
+            && This.callbacks->asioMessage(kAsioSelectorSupported, kAsioEngineVersion, 0, 0)
+            && This.callbacks->asioMessage(kAsioEngineVersion, 0, 0, 0) < 2)
+        {
+            if (This.in_format == SampleFloat32)
+                This.in_format = SampleInt32;
+            if (This.out_format == SampleFloat32)
+                This.out_format = SampleInt32;
+            This.sample_auto = FALSE;
+            if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioResetRequest, 0, 0))
+                This.callbacks->asioMessage(kAsioResetRequest, 0, 0, 0);
+        }
     }
     else
     {
@@ -577,6 +743,11 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_createBuffers, (LPWINEASIO ifa
 
     return ASE_OK;
 
+ERROR_MEM:
+    __wrapped_IWineASIOImpl_disposeBuffers(iface);
+    WARN("no memory\n");
+    return ASE_NoMemory;
+
 ERROR_PARAM:
     __wrapped_IWineASIOImpl_disposeBuffers(iface);
     WARN("invalid parameter\n");
@@ -613,9 +784,31 @@ WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_future, (LPWINEASIO iface, lon
     return ASE_NotPresent;
 }
 
+static void write_outputs(long half);
+
+/* Hosts call this once after createBuffers to see if we support it, and
+ * then at the end of each bufferSwitch, as soon as their output is written.
+ * Once we know, the output goes to jackbridge in the cycle it was written
+ * instead of the next one.
+ */
 WRAP_THISCALL( ASIOError __stdcall, IWineASIOImpl_outputReady, (LPWINEASIO iface))
 {
-    return ASE_NotPresent;
+    if (!This.in_callback)
+    {
+        This.output_ready = TRUE;
+        This.output_latency = This.block_frames;
+        This.infoblock->output_periods = 1;     /* for jackbridge's port latencies */
+        return ASE_OK;
+    }
+
+    if (!This.output_posted)
+    {
+        write_outputs(This.toggle);
+        This.output_posted = TRUE;
+        sem_post(This.semaphore2);
+    }
+
+    return ASE_OK;
 }
 
 static const IWineASIOVtbl WineASIO_Vtbl =
@@ -665,23 +858,103 @@ static void getNanoSeconds(ASIOTimeStamp* ts)
  * The ASIO callback can make WIN32 calls which require a WIN32 thread.
  * Do the callback in this thread and then switch back to the Jack callback thread.
  */
+/* the ASIO output half-buffers to jackbridge */
+static void write_outputs(long half)
+{
+    const Converter *conv = &converters[This.out_buffer_format];
+    int i;
+
+    for (i = 0; i < This.outputs; i++)
+    {
+        if (This.output[i].active == ASIOTrue)
+            conv->to_float(This.outputblock + i * MAX_FRAMES,
+                           &This.output[i].buffer[This.block_frames * half * conv->size], This.block_frames);
+    }
+}
+
+/* Called between cycles when jackbridge reports a new sample rate */
+static void change_rate(void)
+{
+    TRACE("sample rate changed from %f to %u\n", This.sample_rate, This.infoblock->sample_rate);
+    This.sample_rate = This.infoblock->sample_rate;
+    This.miliseconds = (long)((double)(This.block_frames * 1000) / This.sample_rate);
+    This.asio_time.timeInfo.sampleRate = This.sample_rate;
+    This.asio_time.timeInfo.flags |= kSampleRateChanged;
+    if (This.callbacks->sampleRateDidChange)
+        This.callbacks->sampleRateDidChange(This.sample_rate);
+}
+
+/* and once when JACK's period is no longer the host's buffer size: ask
+ * the host to change to it, or failing that to reset
+ */
+static void change_period(long frames)
+{
+    TRACE("JACK's period changed from %ld to %ld frames\n", This.block_frames, frames);
+    This.period_told = frames;
+    if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioBufferSizeChange, 0, 0)
+        && This.callbacks->asioMessage(kAsioBufferSizeChange, frames, 0, 0))
+        return;
+    if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioResetRequest, 0, 0))
+        This.callbacks->asioMessage(kAsioResetRequest, 0, 0, 0);
+    else
+        WARN("the host can't be asked to remake its buffers, restart it\n");
+}
+
+/* Dropouts since the last cycle: a JACK xrun may need the host to resync
+ * its timeline, and our lateness is its overload
+ */
+static void tell_dropouts(void)
+{
+    if (This.infoblock->xruns != This.xruns_told)
+    {
+        This.xruns_told = This.infoblock->xruns;
+        if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioResyncRequest, 0, 0))
+            This.callbacks->asioMessage(kAsioResyncRequest, 0, 0, 0);
+    }
+    if (This.infoblock->late != This.late_told)
+    {
+        This.late_told = This.infoblock->late;
+        if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioOverload, 0, 0))
+            This.callbacks->asioMessage(kAsioOverload, 0, 0, 0);
+    }
+}
+
+/* the host asks getLatencies again when told they have changed */
+static void tell_latencies(void)
+{
+    if (This.infoblock->capture_latency == This.capture_told
+        && This.infoblock->playback_latency == This.playback_told)
+        return;
+
+    This.capture_told = This.infoblock->capture_latency;
+    This.playback_told = This.infoblock->playback_latency;
+    TRACE("JACK latencies now %u capture, %u playback\n", This.capture_told, This.playback_told);
+    if (This.callbacks->asioMessage(kAsioSelectorSupported, kAsioLatenciesChanged, 0, 0))
+        This.callbacks->asioMessage(kAsioLatenciesChanged, 0, 0, 0);
+}
+
 static DWORD CALLBACK win32_callback(LPVOID arg)
 {
 
-    int i, j;
-    float *in, *out;
-    int *buffer;
+    int i;
+    float *in;
+    char *buffer;
+    const Converter *conv;
 
     struct sched_param attr;
 
     attr.__sched_priority = This.infoblock->priority-1;
     sched_setscheduler(0, SCHED_FIFO, &attr);
 
+    if (This.rt_memory && !mem_prefault_stack(This.stack_prefault * 1024))
+        TRACE("couldn't lock the callback thread stack\n");
+
     while (1)
     {
         /* wait to be woken up by the Jack callback thread */
         This.infoblock->running = 1;
         sem_wait(This.semaphore1);
+        This.output_posted = FALSE;
 
         if (This.infoblock->transport_rolling) {
 
@@ -709,20 +982,38 @@ static DWORD CALLBACK win32_callback(LPVOID arg)
 
         if (This.state == Run)
         {
+           if (This.rt_memory)
+               mem_faults_count(&This.faults);
+
+           if (This.infoblock->sample_rate != (unsigned int)This.sample_rate)
+               change_rate();
+           tell_dropouts();
+           tell_latencies();
 
-           memset(This.outputblock, 0, 
-                    sizeof(float) * This.block_frames * This.outputs);
+           /* the host's buffers are for another period: play silence until it remakes them */
+           if (This.infoblock->buffer_frames != This.block_frames)
+           {
+               if (This.period_told != This.infoblock->buffer_frames)
+                   change_period(This.infoblock->buffer_frames);
+               for (i = 0; i < This.outputs; i++)
+                   memset(This.outputblock + i * MAX_FRAMES, 0, sizeof(float) * This.infoblock->buffer_frames);
+               sem_post(This.semaphore2);
+               continue;
+           }
+
+           for (i = 0; i < This.outputs; i++)
+               memset(This.outputblock + i * MAX_FRAMES, 0, sizeof(float) * This.block_frames);
                     
            /* get the input data from JACK and copy it to the ASIO buffers */
            for (i = 0; i < This.inputs; i++)
            {
                if (This.input[i].active == ASIOTrue) {
 
-                  buffer = &This.input[i].buffer[This.block_frames * This.toggle];
-                  in = This.inputblock + i * This.block_frames;
+                  conv = &converters[This.in_buffer_format];
+                  buffer = &This.input[i].buffer[This.block_frames * This.toggle * conv->size];
+                  in = This.inputblock + i * MAX_FRAMES;
 
-                  for (j = 0; j < This.block_frames; j++)
-                      buffer[j] = (int)(in[j] * (float)(0x7fffffff));
+                  conv->from_float(buffer, in, This.block_frames, This.dither ? This.dither_state : NULL);
 
                }
             }
@@ -736,31 +1027,27 @@ static DWORD CALLBACK win32_callback(LPVOID arg)
                     This.asio_time.timeCode.timeCodeSamples.lo = This.asio_time.timeInfo.samplePosition.lo;
                     This.asio_time.timeCode.timeCodeSamples.hi = 0;
                 }
+                This.in_callback = TRUE;
                 This.callbacks->bufferSwitchTimeInfo(&This.asio_time, This.toggle, ASIOTrue);
+                This.in_callback = FALSE;
                 This.asio_time.timeInfo.flags &= ~(kSampleRateChanged | kClockSourceChanged);
             }
             else {
+                This.in_callback = TRUE;
                 This.callbacks->bufferSwitch(This.toggle, ASIOTrue);
+                This.in_callback = FALSE;
             }
 
-            for (i = 0; i < This.outputs; i++)
-            {
-                if (This.output[i].active == ASIOTrue) {
-
-                   buffer = &This.output[i].buffer[This.block_frames * (This.toggle ? 0 : 1)];
-                   out = This.outputblock + i * This.block_frames;
-
-                   for (j = 0; j < This.block_frames; j++)
-                       out[j] = ((float)(buffer[j]) / (float)(0x7fffffff));
-
-                }
-            }
+            /* without outputReady we can't be sure this half is finished, so send the last one */
+            if (!This.output_posted)
+                write_outputs(This.output_ready ? This.toggle : !This.toggle);
 
             This.toggle = This.toggle ? 0 : 1;
             
         }
 
-        sem_post(This.semaphore2);
+        if (!This.output_posted)
+            sem_post(This.semaphore2);
     }
     
     return 0;
@@ -1,6 +1,11 @@
 #define INPUT_PORTS 8
 #define OUTPUT_PORTS 8
 
+/* each channel's room in the buffers segment: the largest period JACK
+ * takes, so a period change never needs a new segment
+ */
+#define MAX_FRAMES 8192
+
 typedef struct _InfoBlock {
    unsigned long long int frame;
    unsigned int transport_rolling;
@@ -10,5 +15,13 @@ typedef struct _InfoBlock {
    unsigned int outputs;
    unsigned int buffer_frames;
    unsigned int sample_rate;
+   unsigned int minor_faults;   /* page faults in the bridge's process thread */
+   unsigned int major_faults;
+   unsigned int xruns;          /* JACK's xrun callbacks: late anywhere in the graph */
+   unsigned int late;           /* the driver's output wasn't there by the end of the period */
+   unsigned int capture_latency;    /* of what the bridge's inputs are connected to */
+   unsigned int playback_latency;   /* and its outputs */
+   unsigned int output_periods;     /* the driver's output leaves this many periods after it is
+                                       written: 2, or 1 once the host calls outputReady */
 } InfoBlock;
 
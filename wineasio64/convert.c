@@ -0,0 +1,594 @@
+/*
+ * Sample conversion between JACK's float buffers and the ASIO buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_KERNELS 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/* Full scale for int32 is (float)0x7fffffff, i.e. 2^31, as it always has
+ * been.  The largest float below 2^31 is 0x7fffff80, so clip there rather
+ * than let +1.0 wrap round to 0x80000000.  int32 is not dithered: a float
+ * only has 24 bits of mantissa to begin with.
+ */
+#define INT32_SCALE     2147483648.0f
+#define INT32_RECIP     (1.0f / 2147483648.0f)
+#define INT32_CLIP_HI   2147483520.0f
+#define INT32_CLIP_LO   -2147483648.0f
+
+#define INT24_SCALE     8388608.0f
+#define INT24_RECIP     (1.0f / 8388608.0f)
+#define INT24_CLIP_HI   8388607.0f
+#define INT24_CLIP_LO   -8388608.0f
+
+#define INT16_SCALE     32768.0f
+#define INT16_RECIP     (1.0f / 32768.0f)
+#define INT16_CLIP_HI   32767.0f
+#define INT16_CLIP_LO   -32768.0f
+
+/* TPDF dither of +/-1 LSB: the difference of the two 16 bit halves of one
+ * xorshift32 step is already triangular, so a sample costs one step.
+ */
+#define TPDF_SCALE      (1.0f / 65536.0f)
+
+static inline float tpdf_c(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)((int)(x & 0xffff) - (int)(x >> 16)) * TPDF_SCALE;
+}
+
+/* round to nearest with clipping, as cvtps2dq does after min/max: lrintf
+ * uses the same rounding mode, so halves go to even in both */
+static inline int clip_round_c(float s, float lo, float hi)
+{
+    if (s > hi) s = hi;
+    else if (!(s >= lo)) s = lo; /* catches NaN too */
+    return (int)lrintf(s);
+}
+
+/*
+ * Plain C kernels, also used for the tails the SIMD loops leave over
+ */
+
+static void float_to_int16_c(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    short *out = dst;
+    int i;
+
+    for (i = 0; i < frames; i++)
+    {
+        float s = src[i] * INT16_SCALE;
+
+        if (dither) s += tpdf_c(dither);
+        out[i] = (short)clip_round_c(s, INT16_CLIP_LO, INT16_CLIP_HI);
+    }
+}
+
+static void int16_to_float_c(float *dst, const void *src, int frames)
+{
+    const short *in = src;
+    int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i] * INT16_RECIP;
+}
+
+static void float_to_int24_c(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    unsigned char *out = dst;
+    int i;
+
+    for (i = 0; i < frames; i++, out += 3)
+    {
+        float s = src[i] * INT24_SCALE;
+        int v;
+
+        if (dither) s += tpdf_c(dither);
+        v = clip_round_c(s, INT24_CLIP_LO, INT24_CLIP_HI);
+        out[0] = v;
+        out[1] = v >> 8;
+        out[2] = v >> 16;
+    }
+}
+
+static void int24_to_float_c(float *dst, const void *src, int frames)
+{
+    const unsigned char *in = src;
+    int i;
+
+    for (i = 0; i < frames; i++, in += 3)
+    {
+        /* put the sample in the top 24 bits so the sign comes for free */
+        int v = (int)((unsigned int)in[0] << 8 | (unsigned int)in[1] << 16 | (unsigned int)in[2] << 24);
+
+        dst[i] = (float)v * INT32_RECIP;
+    }
+}
+
+static void float_to_int32_c(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    int *out = dst;
+    int i;
+
+    for (i = 0; i < frames; i++)
+    {
+        float s = src[i] * INT32_SCALE;
+
+        if (s > INT32_CLIP_HI) s = INT32_CLIP_HI;
+        else if (!(s >= INT32_CLIP_LO)) s = INT32_CLIP_LO;
+        out[i] = (int)s;
+    }
+}
+
+static void int32_to_float_c(float *dst, const void *src, int frames)
+{
+    const int *in = src;
+    int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i] * INT32_RECIP;
+}
+
+static void float_to_float32_c(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    memcpy(dst, src, frames * sizeof(float));
+}
+
+static void float32_to_float_c(float *dst, const void *src, int frames)
+{
+    memcpy(dst, src, frames * sizeof(float));
+}
+
+static void float_to_float64_c(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    double *out = dst;
+    int i;
+
+    for (i = 0; i < frames; i++)
+        out[i] = src[i];
+}
+
+static void float64_to_float_c(float *dst, const void *src, int frames)
+{
+    const double *in = src;
+    int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i];
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * SSE2 kernels
+ *
+ * min/max return their second operand when either is NaN, so the sample
+ * goes first into min, which passes NaN on, and the limit second into max,
+ * which turns it into the low limit just as the C kernels do.
+ */
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static inline SSE2 __m128 tpdf_sse2(__m128i *state)
+{
+    __m128i x = *state;
+
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    *state = x;
+    x = _mm_sub_epi32(_mm_and_si128(x, _mm_set1_epi32(0xffff)), _mm_srli_epi32(x, 16));
+    return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(TPDF_SCALE));
+}
+
+static inline SSE2 __m128i scale_sse2(const float *src, float scale, float lo, float hi, __m128i *state)
+{
+    __m128 s = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(scale));
+
+    if (state) s = _mm_add_ps(s, tpdf_sse2(state));
+    return _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_set1_ps(hi), s), _mm_set1_ps(lo)));
+}
+
+static SSE2 void float_to_int16_sse2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    short *out = dst;
+    __m128i state, *ds = NULL;
+    int i;
+
+    if (dither)
+    {
+        state = _mm_loadu_si128((const __m128i *)dither);
+        ds = &state;
+    }
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m128i a = scale_sse2(src + i, INT16_SCALE, INT16_CLIP_LO, INT16_CLIP_HI, ds);
+        __m128i b = scale_sse2(src + i + 4, INT16_SCALE, INT16_CLIP_LO, INT16_CLIP_HI, ds);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+    if (dither)
+        _mm_storeu_si128((__m128i *)dither, state);
+    float_to_int16_c(out + i, src + i, frames - i, dither);
+}
+
+static SSE2 void int16_to_float_sse2(float *dst, const void *src, int frames)
+{
+    const short *in = src;
+    const __m128 recip = _mm_set1_ps(INT32_RECIP);
+    int i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        /* unpacking against zero leaves each sample in the top 16 bits */
+        __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), s)), recip));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(_mm_setzero_si128(), s)), recip));
+    }
+    int16_to_float_c(dst + i, in + i, frames - i);
+}
+
+/* SSE2 has no byte shuffle, so only the arithmetic is vectorised here */
+static SSE2 void float_to_int24_sse2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    unsigned char *out = dst;
+    __m128i state, *ds = NULL;
+    int v[4];
+    int i, j;
+
+    if (dither)
+    {
+        state = _mm_loadu_si128((const __m128i *)dither);
+        ds = &state;
+    }
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        _mm_storeu_si128((__m128i *)v, scale_sse2(src + i, INT24_SCALE, INT24_CLIP_LO, INT24_CLIP_HI, ds));
+        for (j = 0; j < 4; j++, out += 3)
+        {
+            out[0] = v[j];
+            out[1] = v[j] >> 8;
+            out[2] = v[j] >> 16;
+        }
+    }
+    if (dither)
+        _mm_storeu_si128((__m128i *)dither, state);
+    float_to_int24_c(out, src + i, frames - i, dither);
+}
+
+/* and the other way: the bytes unpacked in C, the conversion vectorised */
+static SSE2 void int24_to_float_sse2(float *dst, const void *src, int frames)
+{
+    const unsigned char *in = src;
+    const __m128 recip = _mm_set1_ps(INT32_RECIP);
+    int v[4];
+    int i, j;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        /* the sample in the top 24 bits, so the sign comes for free */
+        for (j = 0; j < 4; j++, in += 3)
+            v[j] = (int)((unsigned int)in[0] << 8 | (unsigned int)in[1] << 16 | (unsigned int)in[2] << 24);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)v)), recip));
+    }
+    int24_to_float_c(dst + i, in, frames - i);
+}
+
+static SSE2 void float_to_int32_sse2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    int *out = dst;
+    const __m128 scale = _mm_set1_ps(INT32_SCALE);
+    const __m128 hi = _mm_set1_ps(INT32_CLIP_HI);
+    const __m128 lo = _mm_set1_ps(INT32_CLIP_LO);
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+
+        s = _mm_max_ps(_mm_min_ps(hi, s), lo);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_cvttps_epi32(s));
+    }
+    float_to_int32_c(out + i, src + i, frames - i, NULL);
+}
+
+static SSE2 void int32_to_float_sse2(float *dst, const void *src, int frames)
+{
+    const int *in = src;
+    const __m128 recip = _mm_set1_ps(INT32_RECIP);
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(s), recip));
+    }
+    int32_to_float_c(dst + i, in + i, frames - i);
+}
+
+static SSE2 void float_to_float64_sse2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    double *out = dst;
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        __m128 s = _mm_loadu_ps(src + i);
+
+        _mm_storeu_pd(out + i, _mm_cvtps_pd(s));
+        _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(s, s)));
+    }
+    float_to_float64_c(out + i, src + i, frames - i, NULL);
+}
+
+static SSE2 void float64_to_float_sse2(float *dst, const void *src, int frames)
+{
+    const double *in = src;
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+        __m128 b = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(a, b));
+    }
+    float64_to_float_c(dst + i, in + i, frames - i);
+}
+
+/*
+ * AVX2 kernels
+ */
+
+static inline AVX2 __m256 tpdf_avx2(__m256i *state)
+{
+    __m256i x = *state;
+
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    *state = x;
+    x = _mm256_sub_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)), _mm256_srli_epi32(x, 16));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(TPDF_SCALE));
+}
+
+static inline AVX2 __m256i scale_avx2(const float *src, float scale, float lo, float hi, __m256i *state)
+{
+    __m256 s = _mm256_mul_ps(_mm256_loadu_ps(src), _mm256_set1_ps(scale));
+
+    if (state) s = _mm256_add_ps(s, tpdf_avx2(state));
+    return _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_set1_ps(hi), s), _mm256_set1_ps(lo)));
+}
+
+static AVX2 void float_to_int16_avx2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    short *out = dst;
+    __m256i state, *ds = NULL;
+    int i;
+
+    if (dither)
+    {
+        state = _mm256_loadu_si256((const __m256i *)dither);
+        ds = &state;
+    }
+    for (i = 0; i + 16 <= frames; i += 16)
+    {
+        __m256i a = scale_avx2(src + i, INT16_SCALE, INT16_CLIP_LO, INT16_CLIP_HI, ds);
+        __m256i b = scale_avx2(src + i + 8, INT16_SCALE, INT16_CLIP_LO, INT16_CLIP_HI, ds);
+
+        /* packs works per 128 bit lane, put the quarters back in order */
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+    }
+    if (dither)
+        _mm256_storeu_si256((__m256i *)dither, state);
+    float_to_int16_c(out + i, src + i, frames - i, dither);
+}
+
+static AVX2 void int16_to_float_avx2(float *dst, const void *src, int frames)
+{
+    const short *in = src;
+    const __m256 recip = _mm256_set1_ps(INT16_RECIP);
+    int i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m256i s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), recip));
+    }
+    int16_to_float_c(dst + i, in + i, frames - i);
+}
+
+static AVX2 void float_to_int24_avx2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    unsigned char *out = dst;
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m256i state, *ds = NULL;
+    int i;
+
+    if (dither)
+    {
+        state = _mm256_loadu_si256((const __m256i *)dither);
+        ds = &state;
+    }
+    /* each lane stores 16 bytes for 12, so stop while the overhang is still ours */
+    for (i = 0; i + 10 <= frames; i += 8, out += 24)
+    {
+        __m256i v = _mm256_shuffle_epi8(scale_avx2(src + i, INT24_SCALE, INT24_CLIP_LO, INT24_CLIP_HI, ds), pack);
+
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(out + 12), _mm256_extracti128_si256(v, 1));
+    }
+    if (dither)
+        _mm256_storeu_si256((__m256i *)dither, state);
+    float_to_int24_c(out, src + i, frames - i, dither);
+}
+
+static AVX2 void int24_to_float_avx2(float *dst, const void *src, int frames)
+{
+    const unsigned char *in = src;
+    const __m256i unpack = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256 recip = _mm256_set1_ps(INT32_RECIP);
+    int i;
+
+    /* each lane loads 16 bytes for 12, so stop before reading past the end */
+    for (i = 0; i + 10 <= frames; i += 8, in += 24)
+    {
+        __m256i s = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+                                            _mm_loadu_si128((const __m128i *)(in + 12)), 1);
+
+        /* the sample lands in the top 24 bits, so scale as int32 */
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_shuffle_epi8(s, unpack)), recip));
+    }
+    int24_to_float_c(dst + i, in, frames - i);
+}
+
+static AVX2 void float_to_int32_avx2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    int *out = dst;
+    const __m256 scale = _mm256_set1_ps(INT32_SCALE);
+    const __m256 hi = _mm256_set1_ps(INT32_CLIP_HI);
+    const __m256 lo = _mm256_set1_ps(INT32_CLIP_LO);
+    int i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m256 s = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+
+        s = _mm256_max_ps(_mm256_min_ps(hi, s), lo);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_cvttps_epi32(s));
+    }
+    float_to_int32_c(out + i, src + i, frames - i, NULL);
+}
+
+static AVX2 void int32_to_float_avx2(float *dst, const void *src, int frames)
+{
+    const int *in = src;
+    const __m256 recip = _mm256_set1_ps(INT32_RECIP);
+    int i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(in + i));
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), recip));
+    }
+    int32_to_float_c(dst + i, in + i, frames - i);
+}
+
+static AVX2 void float_to_float64_avx2(void *dst, const float *src, int frames, unsigned int *dither)
+{
+    double *out = dst;
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+    float_to_float64_c(out + i, src + i, frames - i, NULL);
+}
+
+static AVX2 void float64_to_float_avx2(float *dst, const void *src, int frames)
+{
+    const double *in = src;
+    int i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+    float64_to_float_c(dst + i, in + i, frames - i);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+Converter converters[SampleFormats] =
+{
+    { "int16",   2, float_to_int16_c,   int16_to_float_c },
+    { "int24",   3, float_to_int24_c,   int24_to_float_c },
+    { "int32",   4, float_to_int32_c,   int32_to_float_c },
+    { "float32", 4, float_to_float32_c, float32_to_float_c },
+    { "float64", 8, float_to_float64_c, float64_to_float_c },
+};
+
+const char *convert_init(void)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        converters[SampleInt16].from_float = float_to_int16_avx2;
+        converters[SampleInt16].to_float = int16_to_float_avx2;
+        converters[SampleInt24].from_float = float_to_int24_avx2;
+        converters[SampleInt24].to_float = int24_to_float_avx2;
+        converters[SampleInt32].from_float = float_to_int32_avx2;
+        converters[SampleInt32].to_float = int32_to_float_avx2;
+        converters[SampleFloat64].from_float = float_to_float64_avx2;
+        converters[SampleFloat64].to_float = float64_to_float_avx2;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        converters[SampleInt16].from_float = float_to_int16_sse2;
+        converters[SampleInt16].to_float = int16_to_float_sse2;
+        converters[SampleInt24].from_float = float_to_int24_sse2;
+        converters[SampleInt24].to_float = int24_to_float_sse2;
+        converters[SampleInt32].from_float = float_to_int32_sse2;
+        converters[SampleInt32].to_float = int32_to_float_sse2;
+        converters[SampleFloat64].from_float = float_to_float64_sse2;
+        converters[SampleFloat64].to_float = float64_to_float_sse2;
+        return "sse2";
+    }
+#endif
+    return "c";
+}
+
+int convert_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < SampleFormats; i++)
+        if (strcasecmp(name, converters[i].name) == 0)
+            return i;
+    return -1;
+}
+
+void convert_seed_dither(unsigned int *dither)
+{
+    unsigned int x = 0x9e3779b9;
+    int i;
+
+    for (i = 0; i < DITHER_LANES; i++)
+    {
+        x = x * 1664525 + 1013904223;
+        dither[i] = x | 1;
+    }
+}
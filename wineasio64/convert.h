@@ -0,0 +1,58 @@
+/*
+ * Sample conversion between JACK's float buffers and the ASIO buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_CONVERT_H
+#define __WINEASIO_CONVERT_H
+
+/* the ASIO buffer formats we can convert to and from (all little endian) */
+enum
+{
+    SampleInt16,
+    SampleInt24,    /* packed, 3 bytes per sample */
+    SampleInt32,
+    SampleFloat32,
+    SampleFloat64,
+    SampleFormats
+};
+
+/* one xorshift state per SIMD lane, none may be zero */
+#define DITHER_LANES 8
+
+/* dither may be NULL; it is only used by the formats narrower than float */
+typedef void (*from_float_func)(void *dst, const float *src, int frames, unsigned int *dither);
+typedef void (*to_float_func)(float *dst, const void *src, int frames);
+
+typedef struct _Converter {
+    const char      *name;      /* as written in the configuration */
+    int             size;       /* bytes per sample in the ASIO buffer */
+    from_float_func from_float; /* JACK -> ASIO */
+    to_float_func   to_float;   /* ASIO -> JACK */
+} Converter;
+
+/* set up by convert_init() with the best kernels this CPU supports */
+extern Converter converters[SampleFormats];
+
+/* select the kernels; returns the name of the instruction set chosen */
+extern const char *convert_init(void);
+
+/* returns the format called name, or -1 */
+extern int convert_lookup(const char *name);
+
+extern void convert_seed_dither(unsigned int *dither);
+
+#endif /* __WINEASIO_CONVERT_H */
@@ -4,6 +4,8 @@
  * as they would be used by many applications.
  */
 
+#define _GNU_SOURCE     /* for RUSAGE_THREAD */
+
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
@@ -11,10 +13,13 @@
 #include <string.h>
 
 #include "common.h"
+#include "probes.h"
 
 #include <semaphore.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <alloca.h>
 #include <fcntl.h>
 
 #include <jack/jack.h>
@@ -22,12 +27,21 @@
 jack_port_t *input_port[INPUT_PORTS];
 jack_port_t *output_port[OUTPUT_PORTS];
 jack_client_t *client;
+const char *bridge_name;        /* ours, as JACK has it, for the probes */
 
 sem_t *sem1, *sem2;
 InfoBlock *info;
 float *in;
 float *out;
 
+/* stack to prefault in the process thread */
+#define STACK_PREFAULT (256 * 1024)
+
+long last_minflt = -1, last_majflt;
+
+/* the driver's output_periods our ports' latency ranges were last set for */
+volatile unsigned int latency_periods;
+
 /* a simple state machine for this client */
 volatile enum {
 	Init,
@@ -50,26 +64,50 @@ process (jack_nframes_t nframes, void *arg)
         jack_transport_state_t ts;
         jack_position_t jack_position_info;
 
+        PROBE2(cycle_start, bridge_name, nframes);
         ts = jack_transport_query(client, &jack_position_info);
         info->transport_rolling = (ts == JackTransportRolling) || (ts == JackTransportLooping);
         info->frame = jack_position_info.frame;
 
         if (info->running == 1) {
+#ifdef RUSAGE_THREAD
+           struct rusage usage;
+
+           /* count our page faults, the driver reports them */
+           if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+              if (last_minflt >= 0) {
+                 info->minor_faults += usage.ru_minflt - last_minflt;
+                 info->major_faults += usage.ru_majflt - last_majflt;
+              }
+              last_minflt = usage.ru_minflt;
+              last_majflt = usage.ru_majflt;
+           }
+#endif
 
+           PROBE2(buffer_write, bridge_name, nframes);
            for (i=0; i<INPUT_PORTS; i++) {
-               memcpy(&in[i*info->buffer_frames], 
+               memcpy(&in[i*MAX_FRAMES], 
                       jack_port_get_buffer (input_port[i], nframes),
                       sizeof (jack_default_audio_sample_t) * nframes);
            }
+           PROBE2(buffer_write_done, bridge_name, nframes);
 
+           PROBE2(handoff_post, bridge_name, nframes);
            sem_post(sem1);
+           PROBE2(handoff_wait, bridge_name, nframes);
            sem_wait(sem2);
+           PROBE2(handoff_woken, bridge_name, nframes);
+
+           if (jack_frames_since_cycle_start(client) > nframes)
+              info->late++;
            
+           PROBE2(buffer_read, bridge_name, nframes);
            for (i=0; i<OUTPUT_PORTS; i++) {
                memcpy(jack_port_get_buffer (output_port[i], nframes),
-                      &out[i*info->buffer_frames],
+                      &out[i*MAX_FRAMES],
                       sizeof (jack_default_audio_sample_t) * nframes);
            }
+           PROBE2(buffer_read_done, bridge_name, nframes);
         }
         else {
 
@@ -82,9 +120,128 @@ process (jack_nframes_t nframes, void *arg)
 
         }
 
+        PROBE2(cycle_end, bridge_name, nframes);
 	return 0;      
 }
 
+/**
+ * Runs in the process thread before its first cycle; lock and touch
+ * enough of its stack that process() never faults on it.
+ */
+void
+thread_init (void *arg)
+{
+        volatile char *stack = alloca(STACK_PREFAULT);
+        int i;
+
+        mlock((void *)stack, STACK_PREFAULT);
+        for (i = 0; i < STACK_PREFAULT; i += 4096)
+           stack[i] = 0;
+}
+
+/**
+ * Lock a shared memory segment and touch every page of it.
+ */
+void
+lock_segment (void *addr, size_t size)
+{
+        volatile char *p = addr;
+        size_t i;
+
+        if (mlock(addr, size) == 0)
+           return;
+
+        fprintf (stderr, "cannot lock shared memory, check RLIMIT_MEMLOCK\n");
+        /* the driver may be writing already, so touch without losing its stores */
+        for (i = 0; i < size; i += 4096)
+           __sync_fetch_and_add (&p[i], 0);
+}
+
+/**
+ * The period and rate are read by the driver at each cycle, and it sorts
+ * out the host.  The buffers have room for any period.
+ */
+int
+buffer_size (jack_nframes_t nframes, void *arg)
+{
+        if (nframes > MAX_FRAMES) {
+           fprintf (stderr, "period of %u frames is too big, stopping\n", nframes);
+           client_state = Exit;
+           return 1;
+        }
+        info->buffer_frames = nframes;
+        return 0;
+}
+
+int
+sample_rate (jack_nframes_t nframes, void *arg)
+{
+        info->sample_rate = nframes;
+        return 0;
+}
+
+/**
+ * The largest latency range of a set of ports.
+ */
+void
+ports_latency (jack_port_t **ports, int count, jack_latency_callback_mode_t mode, jack_latency_range_t *most)
+{
+        jack_latency_range_t range;
+        int i;
+
+        most->min = most->max = 0;
+        for (i = 0; i < count; i++) {
+           jack_port_get_latency_range (ports[i], mode, &range);
+           if (range.min > most->min)
+              most->min = range.min;
+           if (range.max > most->max)
+              most->max = range.max;
+        }
+}
+
+/**
+ * Whenever latencies in the graph change: publish what our ports are
+ * connected to for the driver's getLatencies, and set our own ports'
+ * ranges.  Those go through the host, a period in and as many out as
+ * the driver says it holds its output back.
+ */
+void
+latency (jack_latency_callback_mode_t mode, void *arg)
+{
+        jack_latency_range_t range;
+        unsigned int periods = info->output_periods ? info->output_periods : 2;
+        unsigned int through = (1 + periods) * info->buffer_frames;
+        int i;
+
+        latency_periods = periods;
+
+        if (mode == JackCaptureLatency) {
+           ports_latency (input_port, INPUT_PORTS, mode, &range);
+           info->capture_latency = range.max;
+           range.min += through;
+           range.max += through;
+           for (i = 0; i < OUTPUT_PORTS; i++)
+              jack_port_set_latency_range (output_port[i], mode, &range);
+        } else {
+           ports_latency (output_port, OUTPUT_PORTS, mode, &range);
+           info->playback_latency = range.max;
+           range.min += through;
+           range.max += through;
+           for (i = 0; i < INPUT_PORTS; i++)
+              jack_port_set_latency_range (input_port[i], mode, &range);
+        }
+}
+
+/**
+ * Counted for the driver to pass on, and for anyone reading wineasio-info.
+ */
+int
+xrun (void *arg)
+{
+        info->xruns++;
+        return 0;
+}
+
 /**
  * JACK calls this shutdown_callback if the server ever shuts down or
  * decides to disconnect the client.
@@ -140,12 +297,18 @@ main (int argc, char *argv[])
 		client_name = jack_get_client_name(client);
 		fprintf (stderr, "unique name `%s' assigned\n", client_name);
 	}
+	bridge_name = jack_get_client_name(client);
 
 	/* tell the JACK server to call `process()' whenever
 	   there is work to be done.
 	*/
 
+	jack_set_thread_init_callback (client, thread_init, 0);
 	jack_set_process_callback (client, process, 0);
+	jack_set_buffer_size_callback (client, buffer_size, 0);
+	jack_set_sample_rate_callback (client, sample_rate, 0);
+	jack_set_xrun_callback (client, xrun, 0);
+	jack_set_latency_callback (client, latency, 0);
 
 	/* tell the JACK server to call `jack_shutdown()' if
 	   it ever shuts down, either entirely, or if it
@@ -199,6 +362,14 @@ main (int argc, char *argv[])
         info->outputs = OUTPUT_PORTS;
         info->buffer_frames = (unsigned int)jack_get_buffer_size(client);
         info->sample_rate = (unsigned int)jack_get_sample_rate(client);
+        info->minor_faults = 0;
+        info->major_faults = 0;
+        info->xruns = 0;
+        info->late = 0;
+        info->capture_latency = 0;
+        info->playback_latency = 0;
+        info->output_periods = 2;
+        lock_segment(info, sizeof(InfoBlock));
 
         if ((handle = shm_open("wineasio-buffers", O_CREAT | O_RDWR, 0666)) == -1)
         {
@@ -206,13 +377,14 @@ main (int argc, char *argv[])
            exit(2);
         }
 
-        ftruncate(handle, sizeof(float)* info->buffer_frames * (info->inputs + info->outputs));
+        ftruncate(handle, sizeof(float)* MAX_FRAMES * (info->inputs + info->outputs));
         in = (float *)mmap(0,
-                           sizeof(float) * info->buffer_frames * (info->inputs + info->outputs),
+                           sizeof(float) * MAX_FRAMES * (info->inputs + info->outputs),
                            PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
         close(handle);
+        lock_segment(in, sizeof(float) * MAX_FRAMES * (info->inputs + info->outputs));
 
-        out = in + info->inputs * info->buffer_frames;
+        out = in + info->inputs * MAX_FRAMES;
 
 	if (jack_activate (client)) {
 		fprintf (stderr, "cannot activate client");
@@ -253,8 +425,13 @@ main (int argc, char *argv[])
 
 	free (ports);
 */
-	/* keep running until the transport stops */
-        while (client_state != Exit) sleep(1);
+	/* keep running until the transport stops; have JACK ask for our
+	 * latencies again when the driver's output depth changes */
+        while (client_state != Exit) {
+           sleep(1);
+           if (info->output_periods && info->output_periods != latency_periods)
+              jack_recompute_total_latencies (client);
+        }
 
         sem_destroy(sem2);
         sem_destroy(sem1);
@@ -0,0 +1,42 @@
+/*
+ * Static probes on the audio path, for perf and bpftrace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_PROBES_H
+#define __WINEASIO_PROBES_H
+
+/* USDT probes of provider jackbridge, costing a nop each until perf or
+ * bpftrace attaches; nothing at all without systemtap's sys/sdt.h, which
+ * the Makefile looks for.
+ *
+ * cycle_start, cycle_end          (client, nframes)   process()
+ * handoff_post                    (client, nframes)   waking the driver
+ * handoff_wait, handoff_woken     (client, nframes)   and waiting for it
+ * buffer_write, buffer_write_done,
+ * buffer_read, buffer_read_done   (client, nframes)   to and from the shared buffers
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a)         DTRACE_PROBE1(jackbridge, name, a)
+#define PROBE2(name, a, b)      DTRACE_PROBE2(jackbridge, name, a, b)
+#else
+#define PROBE1(name, a)         do { } while (0)
+#define PROBE2(name, a, b)      do { } while (0)
+#endif
+
+#endif /* __WINEASIO_PROBES_H */